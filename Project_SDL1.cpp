@@ -5,16 +5,47 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <numeric>
 #include <random>
+#include <sstream>
 #include <string>
+#include <type_traits>
 
-void init() {
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC and Clang only emit AVX2 instructions in functions marked for it,
+// MSVC accepts the intrinsics anywhere
+#if defined(SIMD_X86) && defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+void init(bool headless) {
     // Initialize SDL
-    if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_VIDEO) < 0)
+    if (SDL_Init(headless ? SDL_INIT_TIMER : SDL_INIT_TIMER | SDL_INIT_VIDEO) < 0)
         throw std::runtime_error("init():" + std::string(SDL_GetError()));
 
+    if (headless)
+        return;
+
     // Initialize PNG loading
     int imgFlags = IMG_INIT_PNG;
     if (!(IMG_Init(imgFlags) & imgFlags))
@@ -22,220 +53,2889 @@ void init() {
             "SDL_image Error: " +
             std::string(IMG_GetError()));
 }
+namespace {
+    // Defining a namespace without a name -> Anonymous workspace
+    // Its purpose is to indicate to the compiler that everything
+    // inside of it is UNIQUELY used within this source file.
+
+    // Raw binary values and columns for replays, in native byte order
+    template <typename T>
+    void write_value(std::ostream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    T read_value(std::istream& in) {
+        T value;
+        if (!in.read(reinterpret_cast<char*>(&value), sizeof(T)))
+            throw std::runtime_error("read_value(): unexpected end of data");
+        return value;
+    }
+
+    // Layout of ground snapshots, see ground::save. The columns follow the
+    // header in the order of the offsets, each one aligned on
+    // snapshot_alignment bytes.
+    const char snapshot_magic[4] = { 'H', 'R', 'D', 'S' };
+    constexpr Uint32 snapshot_version = 6;
+    constexpr Uint32 snapshot_byte_order = 0x01020304;
+    constexpr Uint64 snapshot_alignment = 64;
+    constexpr int snapshot_column_count = 13;
+
+    struct snapshot_header {
+        char magic[4];
+        Uint32 version;
+        Uint32 byte_order; // snapshot_byte_order as written by the saving machine
+        Uint32 species_count;
+        Uint32 world_width;
+        Uint32 world_height;
+        Uint32 boundary;
+        Sint32 retarget_radius;
+        Uint64 seed;
+        random_generator generator;
+        Uint64 animal_count;
+        Uint64 chunk_generator_count;
+        Uint64 entry_count; // Of the handle table
+        Uint64 free_entry_count;
+        // x, y, previous x, previous y, target x, target y, species, rest,
+        // handle entry, then the chunk generators, the index and generation
+        // of each handle table entry and the free entries
+        Uint64 offsets[snapshot_column_count];
+    };
+    static_assert(std::is_trivially_copyable<random_generator>::value,
+        "snapshots store random generators as raw bytes");
+
+    template <typename T>
+    void read_column(const char* data, size_t size, Uint64 offset, size_t count,
+        std::vector<T>& column) {
+        if (offset > size || count > (size - offset) / sizeof(T))
+            throw std::runtime_error("read_column(): column past the end of the snapshot");
+        column.resize(count);
+        std::memcpy(column.data(), data + offset, count * sizeof(T));
+    }
+
+    // Read-only mapping of a whole file
+    class mapped_file {
+    private:
+        const char* data_;
+        size_t size_;
+#ifdef _WIN32
+        HANDLE file_, mapping_;
+#else
+        int file_;
+#endif
+    public:
+        explicit mapped_file(const std::string& path);
+        ~mapped_file();
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        const char* data() const { return data_; }
+        size_t size() const { return size_; }
+    };
+
+#ifdef _WIN32
+    mapped_file::mapped_file(const std::string& path) {
+        data_ = NULL;
+        size_ = 0;
+        mapping_ = NULL;
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER size;
+        if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size))
+        {
+            if (file_ != INVALID_HANDLE_VALUE)
+                CloseHandle(file_);
+            throw std::runtime_error("mapped_file(): could not open " + path);
+        }
+        size_ = size_t(size.QuadPart);
+        if (size_)
+        {
+            mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping_)
+                data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+            if (!data_)
+            {
+                if (mapping_)
+                    CloseHandle(mapping_);
+                CloseHandle(file_);
+                throw std::runtime_error("mapped_file(): could not map " + path);
+            }
+        }
+    }
+
+    mapped_file::~mapped_file() {
+        if (data_)
+            UnmapViewOfFile(data_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        CloseHandle(file_);
+    }
+#else
+    mapped_file::mapped_file(const std::string& path) {
+        data_ = NULL;
+        size_ = 0;
+        file_ = open(path.c_str(), O_RDONLY);
+        struct stat status;
+        if (file_ < 0 || fstat(file_, &status) < 0)
+        {
+            if (file_ >= 0)
+                close(file_);
+            throw std::runtime_error("mapped_file(): could not open " + path);
+        }
+        size_ = size_t(status.st_size);
+        if (size_)
+        {
+            void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, file_, 0);
+            if (data == MAP_FAILED)
+            {
+                close(file_);
+                throw std::runtime_error("mapped_file(): could not map " + path);
+            }
+            data_ = static_cast<const char*>(data);
+        }
+    }
+
+    mapped_file::~mapped_file() {
+        if (data_)
+            munmap(const_cast<char*>(data_), size_);
+        close(file_);
+    }
+#endif
+
+    SDL_Surface* load_surface_for(const std::string& path,
+        SDL_Surface* window_surface_ptr) {
+
+        // Helper function to load a png for a specific surface
+        SDL_Surface* image = IMG_Load(path.c_str());
+        if (!image)
+            throw std::runtime_error("load_surface_for(): could not load " +
+                path + ": " + std::string(IMG_GetError()));
+        if (!window_surface_ptr)
+            return image;
+
+        // Convert once to the window pixel format so that drawing is a plain
+        // copy instead of a per-pixel format conversion on every frame.
+        // The window surface usually has no alpha channel, in which case the
+        // sprite keeps the window channel layout plus an alpha channel so its
+        // transparent background is still blended away. Windows with less
+        // than 32 bit pixels have no room for one, their sprites are ARGB8888.
+        SDL_PixelFormat* window_format = window_surface_ptr->format;
+        Uint32 pixel_format = window_format->format;
+        if (image->format->Amask && !window_format->Amask) {
+            if (window_format->BytesPerPixel == 4) {
+                Uint32 rgb_mask = window_format->Rmask | window_format->Gmask |
+                    window_format->Bmask;
+                pixel_format = SDL_MasksToPixelFormatEnum(32, window_format->Rmask,
+                    window_format->Gmask, window_format->Bmask, ~rgb_mask);
+            }
+            else
+                pixel_format = SDL_PIXELFORMAT_ARGB8888;
+        }
+
+        SDL_Surface* converted = SDL_ConvertSurfaceFormat(image, pixel_format, 0);
+        SDL_FreeSurface(image);
+        if (!converted)
+            throw std::runtime_error("load_surface_for(): could not convert " +
+                path + ": " + std::string(SDL_GetError()));
+
+        if (SDL_ISPIXELFORMAT_ALPHA(converted->format->format))
+            SDL_SetSurfaceBlendMode(converted, SDL_BLENDMODE_BLEND);
+        return converted;
+    }
+
+    // Whether blend_row can draw the sprites of the atlas onto target:
+    // both need 32 bit pixels with the same colors, the sprites having
+    // their alpha in the top byte, see sprite_atlas::premultiplied
+    bool can_blend(const sprite_atlas& atlas, const SDL_Surface* target) {
+        const SDL_PixelFormat* sprites = atlas.surface()->format;
+        const SDL_PixelFormat* window = target->format;
+        return atlas.premultiplied() && window->BytesPerPixel == 4 &&
+            sprites->Rmask == window->Rmask &&
+            sprites->Gmask == window->Gmask && sprites->Bmask == window->Bmask;
+    }
+
+    // Blending kernels, see blend_row. A product p of two bytes is divided
+    // by 255, rounded to the nearest, as (p + 128 + ((p + 128) >> 8)) >> 8,
+    // which is exact over that range. The sum with the sprite byte cannot
+    // overflow: a premultiplied byte is at most alpha, and the rest at most
+    // 255 - alpha. Transparent sprite pixels are all zeros and leave the
+    // target as it is, opaque ones replace it. The SIMD versions must stay
+    // bit-identical to blend_row_scalar.
+
+    void blend_row_scalar(Uint32* target, const Uint32* sprite, int count) {
+        for (int i = 0; i < count; i++)
+        {
+            Uint32 s = sprite[i];
+            Uint32 alpha = s >> 24;
+            if (alpha == 0)
+                continue;
+            if (alpha == 255)
+            {
+                target[i] = s;
+                continue;
+            }
+            // Two bytes at a time, each in its own 16 bit half
+            Uint32 d = target[i], inverse = 255 - alpha;
+            Uint32 blue_red = (d & 0xff00ff) * inverse + 0x800080;
+            blue_red = ((blue_red + (blue_red >> 8 & 0xff00ff)) >> 8) & 0xff00ff;
+            Uint32 green_alpha = (d >> 8 & 0xff00ff) * inverse + 0x800080;
+            green_alpha = (green_alpha + (green_alpha >> 8 & 0xff00ff)) & 0xff00ff00;
+            target[i] = s + (blue_red | green_alpha);
+        }
+    }
+
+    // Blend the part of the sprite 'source' of the atlas drawn at (x, y)
+    // which falls inside clip, see blend_row
+    void blend_sprite(const sprite_atlas& atlas, const SDL_Rect& source, SDL_Surface* target,
+        int x, int y, const SDL_Rect& clip) {
+        static const SIMD_LEVEL kernel = fastest_simd_level();
+        int left = std::max(x, clip.x), top = std::max(y, clip.y);
+        int right = std::min(x + source.w, clip.x + clip.w);
+        int bottom = std::min(y + source.h, clip.y + clip.h);
+        if (left >= right || top >= bottom)
+            return;
+        int atlas_width = atlas.surface()->w;
+        for (int row = top; row < bottom; row++)
+        {
+            const Uint32* sprite = atlas.premultiplied() +
+                size_t(source.y + row - y) * atlas_width + source.x + left - x;
+            Uint32* pixels = reinterpret_cast<Uint32*>(
+                static_cast<Uint8*>(target->pixels) + row * target->pitch) + left;
+            blend_row(pixels, sprite, right - left, kernel);
+        }
+    }
+
+    // Movement kernels: walk every animal one pixel toward its target on
+    // each axis, then flag in arrived[] those standing on their target.
+    // The SIMD versions must stay bit-identical to move_scalar.
+
+    void move_scalar(int* x, int* y, const int* target_x, const int* target_y,
+        Uint8* arrived, size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            x[i] += (x[i] < target_x[i]) - (x[i] > target_x[i]);
+            y[i] += (y[i] < target_y[i]) - (y[i] > target_y[i]);
+            arrived[i] = x[i] == target_x[i] && y[i] == target_y[i];
+        }
+    }
+
+#ifdef SIMD_X86
+    // Comparisons give -1 in the lanes where they hold, so subtracting
+    // (x < target) and adding (x > target) is the scalar step
+    void move_sse2(int* x, int* y, const int* target_x, const int* target_y,
+        Uint8* arrived, size_t count) {
+        const __m128i one = _mm_set1_epi8(1);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i px = _mm_loadu_si128((const __m128i*)(x + i));
+            __m128i py = _mm_loadu_si128((const __m128i*)(y + i));
+            __m128i tx = _mm_loadu_si128((const __m128i*)(target_x + i));
+            __m128i ty = _mm_loadu_si128((const __m128i*)(target_y + i));
+
+            px = _mm_add_epi32(_mm_sub_epi32(px, _mm_cmplt_epi32(px, tx)),
+                _mm_cmpgt_epi32(px, tx));
+            py = _mm_add_epi32(_mm_sub_epi32(py, _mm_cmplt_epi32(py, ty)),
+                _mm_cmpgt_epi32(py, ty));
+            _mm_storeu_si128((__m128i*)(x + i), px);
+            _mm_storeu_si128((__m128i*)(y + i), py);
+
+            // Narrow the 4 lane masks to 4 bytes of 0 or 1
+            __m128i done = _mm_and_si128(_mm_cmpeq_epi32(px, tx), _mm_cmpeq_epi32(py, ty));
+            done = _mm_packs_epi32(done, done);
+            done = _mm_and_si128(_mm_packs_epi16(done, done), one);
+            int flags = _mm_cvtsi128_si32(done);
+            std::memcpy(arrived + i, &flags, 4);
+        }
+        move_scalar(x + i, y + i, target_x + i, target_y + i, arrived + i, count - i);
+    }
+
+    TARGET_AVX2
+    void move_avx2(int* x, int* y, const int* target_x, const int* target_y,
+        Uint8* arrived, size_t count) {
+        const __m256i one = _mm256_set1_epi8(1);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i px = _mm256_loadu_si256((const __m256i*)(x + i));
+            __m256i py = _mm256_loadu_si256((const __m256i*)(y + i));
+            __m256i tx = _mm256_loadu_si256((const __m256i*)(target_x + i));
+            __m256i ty = _mm256_loadu_si256((const __m256i*)(target_y + i));
+
+            px = _mm256_add_epi32(_mm256_sub_epi32(px, _mm256_cmpgt_epi32(tx, px)),
+                _mm256_cmpgt_epi32(px, tx));
+            py = _mm256_add_epi32(_mm256_sub_epi32(py, _mm256_cmpgt_epi32(ty, py)),
+                _mm256_cmpgt_epi32(py, ty));
+            _mm256_storeu_si256((__m256i*)(x + i), px);
+            _mm256_storeu_si256((__m256i*)(y + i), py);
+
+            // Packing works per 128 bit half, so lanes 0-3 end up in the first
+            // 4 bytes of the low half and lanes 4-7 in those of the high half
+            __m256i done = _mm256_and_si256(_mm256_cmpeq_epi32(px, tx),
+                _mm256_cmpeq_epi32(py, ty));
+            done = _mm256_packs_epi32(done, done);
+            done = _mm256_and_si256(_mm256_packs_epi16(done, done), one);
+            int low = _mm_cvtsi128_si32(_mm256_castsi256_si128(done));
+            int high = _mm_cvtsi128_si32(_mm256_extracti128_si256(done, 1));
+            std::memcpy(arrived + i, &low, 4);
+            std::memcpy(arrived + i + 4, &high, 4);
+        }
+        move_scalar(x + i, y + i, target_x + i, target_y + i, arrived + i, count - i);
+    }
+
+    // Bytes of the target times 255 - alpha, divided by 255, for two pixels
+    // spread over 16 bit lanes, inverse holding 255 - alpha in each lane
+    inline __m128i scale_sse2(__m128i lanes, __m128i inverse) {
+        __m128i product = _mm_add_epi16(_mm_mullo_epi16(lanes, inverse), _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+    }
+
+    void blend_row_sse2(Uint32* target, const Uint32* sprite, int count) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i opaque = _mm_set1_epi16(255);
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i*)(sprite + i));
+            __m128i alpha = _mm_srli_epi32(s, 24);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xffff)
+                continue;
+            __m128i d = _mm_loadu_si128((const __m128i*)(target + i));
+            // 255 - alpha in both 16 bit halves of each pixel, then in the
+            // four lanes of each pixel once unpacked
+            __m128i inverse = _mm_sub_epi16(opaque, _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16)));
+            __m128i low = scale_sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(inverse, inverse));
+            __m128i high = scale_sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(inverse, inverse));
+            _mm_storeu_si128((__m128i*)(target + i), _mm_add_epi8(s, _mm_packus_epi16(low, high)));
+        }
+        blend_row_scalar(target + i, sprite + i, count - i);
+    }
+
+    TARGET_AVX2
+    inline __m256i scale_avx2(__m256i lanes, __m256i inverse) {
+        __m256i product = _mm256_add_epi16(_mm256_mullo_epi16(lanes, inverse),
+            _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_add_epi16(product, _mm256_srli_epi16(product, 8)), 8);
+    }
+
+    // Same as blend_row_sse2, the unpacks and the pack working within each
+    // 128 bit half
+    TARGET_AVX2
+    void blend_row_avx2(Uint32* target, const Uint32* sprite, int count) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i opaque = _mm256_set1_epi16(255);
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i s = _mm256_loadu_si256((const __m256i*)(sprite + i));
+            __m256i alpha = _mm256_srli_epi32(s, 24);
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(alpha, zero)) == -1)
+                continue;
+            __m256i d = _mm256_loadu_si256((const __m256i*)(target + i));
+            __m256i inverse = _mm256_sub_epi16(opaque,
+                _mm256_or_si256(alpha, _mm256_slli_epi32(alpha, 16)));
+            __m256i low = scale_avx2(_mm256_unpacklo_epi8(d, zero),
+                _mm256_unpacklo_epi32(inverse, inverse));
+            __m256i high = scale_avx2(_mm256_unpackhi_epi8(d, zero),
+                _mm256_unpackhi_epi32(inverse, inverse));
+            _mm256_storeu_si256((__m256i*)(target + i),
+                _mm256_add_epi8(s, _mm256_packus_epi16(low, high)));
+        }
+        blend_row_scalar(target + i, sprite + i, count - i);
+    }
+#endif
+} // namespace
+
+SIMD_LEVEL fastest_simd_level() {
+#ifdef SIMD_X86
+    if (SDL_HasAVX2())
+        return SIMD_LEVEL::AVX2;
+    return SIMD_LEVEL::SSE2;
+#else
+    return SIMD_LEVEL::SCALAR;
+#endif
+}
+
+void blend_row(Uint32* target, const Uint32* sprite, int count, SIMD_LEVEL kernel) {
+    switch (kernel)
+    {
+#ifdef SIMD_X86
+    case SIMD_LEVEL::AVX2:
+        blend_row_avx2(target, sprite, count);
+        break;
+    case SIMD_LEVEL::SSE2:
+        blend_row_sse2(target, sprite, count);
+        break;
+#endif
+    default:
+        blend_row_scalar(target, sprite, count);
+    }
+}
+
+// ---------------- run_config class impl ----------------
+
+double run_config::frame_time() const {
+    return 1. / frame_rate;
+}
+
+void run_config::set(const std::string& name, const std::string& value) {
+    unsigned* field = name == "frame_width" ? &frame_width :
+        name == "frame_height" ? &frame_height :
+        name == "frame_boundary" ? &frame_boundary :
+        name == "world_width" ? &world_width :
+        name == "world_height" ? &world_height : NULL;
+    if (!field && name != "frame_rate" && name != "retarget_radius")
+        throw std::runtime_error("run_config::set(): unknown parameter " + name);
+
+    double number = 0.;
+    size_t parsed = 0;
+    try
+    {
+        number = std::stod(value, &parsed);
+    }
+    catch (const std::exception&)
+    {
+        parsed = 0;
+    }
+    if (!parsed || parsed != value.size() || !(number > 0) || number > SDL_MAX_SINT32)
+        throw std::runtime_error("run_config::set(): " + name +
+            " must be a positive number, not '" + value + "'");
+    if (name == "frame_rate")
+    {
+        frame_rate = number;
+        return;
+    }
+    if (number != std::floor(number))
+        throw std::runtime_error("run_config::set(): " + name +
+            " must be a whole number of pixels, not '" + value + "'");
+    if ((name == "world_width" || name == "world_height") && number > max_world_size)
+        throw std::runtime_error("run_config::set(): " + name + " must be at most " +
+            std::to_string(max_world_size) + " pixels, not '" + value + "'");
+    if (field)
+        *field = unsigned(number);
+    else
+        retarget_radius = int(number);
+}
+
+void run_config::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("run_config::load(): could not open " + path);
+    auto trim = [](const std::string& text) {
+        size_t first = text.find_first_not_of(" \t\r");
+        if (first == std::string::npos)
+            return std::string();
+        return text.substr(first, text.find_last_not_of(" \t\r") + 1 - first);
+    };
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++)
+    {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        size_t equals = line.find('=');
+        if (equals == std::string::npos)
+            throw std::runtime_error("run_config::load(): " + path + ":" +
+                std::to_string(number) + ": expected name = value");
+        set(trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+    }
+}
+
+// ---------------- random_generator class impl ----------------
+
+random_generator::random_generator(Uint64 seed, Uint64 stream) {
+    // Seeding procedure of the reference PCG32 implementation
+    state_ = 0;
+    increment_ = (stream << 1u) | 1u;
+    next();
+    state_ += seed;
+    next();
+}
+
+Uint32 random_generator::next() {
+    Uint64 old_state = state_;
+    state_ = old_state * 6364136223846793005ULL + increment_;
+    Uint32 xor_shifted = Uint32(((old_state >> 18u) ^ old_state) >> 27u);
+    Uint32 rotation = Uint32(old_state >> 59u);
+    return (xor_shifted >> rotation) | (xor_shifted << ((32 - rotation) & 31));
+}
+
+int random_generator::between(int min, int max) {
+    // Scale with a multiplication instead of a modulo, the bias is
+    // negligible for the small ranges used here
+    Uint64 range = Uint64(Sint64(max) - min + 1);
+    return int(min + Sint64((next() * range) >> 32));
+}
+
+// ---------------- worker_pool class impl ----------------
+
+worker_pool::worker_pool(unsigned thread_count) {
+    task_ = NULL;
+    task_count_ = 0;
+    next_task_ = 0;
+    busy_workers_ = 0;
+    generation_ = 0;
+    stopping_ = false;
+    for (unsigned i = 1; i < thread_count; i++)
+        threads_.emplace_back(&worker_pool::work, this);
+}
+
+worker_pool::~worker_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& thread : threads_)
+        thread.join();
+}
+
+unsigned worker_pool::thread_count() const {
+    return unsigned(threads_.size() + 1);
+}
+
+void worker_pool::run_tasks() {
+    for (size_t i = next_task_++; i < task_count_; i = next_task_++)
+        (*task_)(i);
+}
+
+void worker_pool::work() {
+    Uint64 seen_generation = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+        if (stopping_)
+            return;
+        seen_generation = generation_;
+
+        lock.unlock();
+        run_tasks();
+        lock.lock();
+
+        if (--busy_workers_ == 0)
+            done_.notify_one();
+    }
+}
+
+void worker_pool::parallel_for(size_t task_count,
+    const std::function<void(size_t)>& task) {
+    if (threads_.empty() || task_count <= 1) {
+        for (size_t i = 0; i < task_count; i++)
+            task(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        task_count_ = task_count;
+        next_task_ = 0;
+        busy_workers_ = threads_.size();
+        generation_++;
+    }
+    wake_.notify_all();
+
+    run_tasks();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&] { return busy_workers_ == 0; });
+}
+
+// ---------------- spatial_grid class impl ----------------
+
+spatial_grid::spatial_grid(int width, int height, int max_cell_size) {
+    width_ = width;
+    height_ = height;
+    max_cell_size_ = max_cell_size;
+    cell_size_ = max_cell_size;
+    columns_ = 1;
+    rows_ = 1;
+    cell_start_.assign(2, 0);
+}
+
+void spatial_grid::rebuild(const int* x, const int* y, const Uint8* species_of,
+    SPECIES species, size_t count) {
+    size_t indexed = 0;
+    for (size_t i = 0; i < count; i++)
+        indexed += species_of[i] == species;
+
+    // Pick the cell side giving about grid_animals_per_cell animals per cell,
+    // but no smaller than needed to stay under grid_cells_per_animal cells
+    // per animal, however large the world
+    double area = double(width_) * height_;
+    double side = indexed ? std::sqrt(area * grid_animals_per_cell / indexed) : max_cell_size_;
+    double min_side = std::sqrt(area / (double(grid_cells_per_animal) * (indexed + 1)));
+    cell_size_ = int(std::max(std::min(std::max(side, 2.), double(max_cell_size_)),
+        std::ceil(min_side)));
+    columns_ = int((Sint64(width_) + cell_size_ - 1) / cell_size_);
+    rows_ = int((Sint64(height_) + cell_size_ - 1) / cell_size_);
+    cell_start_.assign(size_t(columns_) * rows_ + 1, 0);
+    entries_.resize(indexed);
+    cell_of_.resize(count);
+
+    // Count the animals of each cell, shifted by one so that the prefix
+    // sum gives the start of each cell
+    for (size_t i = 0; i < count; i++)
+    {
+        if (species_of[i] != species)
+            continue;
+        Uint32 cell = Uint32(size_t(row_of(y[i])) * columns_ + column_of(x[i]));
+        cell_of_[i] = cell;
+        cell_start_[cell + 1]++;
+    }
+    std::partial_sum(cell_start_.begin(), cell_start_.end(), cell_start_.begin());
+
+    // Fill the cells, using the start of the next cell as write cursor, then
+    // shift back. Animals keep their relative order inside of a cell.
+    for (size_t i = 0; i < count; i++)
+    {
+        if (species_of[i] == species)
+            entries_[cell_start_[cell_of_[i]]++] = Uint32(i);
+    }
+    std::copy_backward(cell_start_.begin(), cell_start_.end() - 1, cell_start_.end());
+    cell_start_[0] = 0;
+}
+
+int spatial_grid::cell_size() const {
+    return cell_size_;
+}
+
+int spatial_grid::columns() const {
+    return columns_;
+}
+
+int spatial_grid::rows() const {
+    return rows_;
+}
+
+int spatial_grid::column_of(int x) const {
+    return std::min(std::max(x / cell_size_, 0), columns_ - 1);
+}
+
+int spatial_grid::row_of(int y) const {
+    return std::min(std::max(y / cell_size_, 0), rows_ - 1);
+}
+
+const Uint32* spatial_grid::cell_begin(int column, int row) const {
+    return entries_.data() + cell_start_[size_t(row) * columns_ + column];
+}
+
+const Uint32* spatial_grid::cell_end(int column, int row) const {
+    return entries_.data() + cell_start_[size_t(row) * columns_ + column + 1];
+}
+
+// ---------------- sprite_atlas class impl ----------------
+
+sprite_atlas::sprite_atlas(const std::vector<std::string>& file_paths,
+    SDL_Surface* window_surface_ptr, SDL_Renderer* renderer_ptr) {
+    surface_ = NULL;
+    texture_ = NULL;
+
+    std::vector<SDL_Surface*> sprites;
+    try
+    {
+        for (const std::string& file_path : file_paths)
+            sprites.push_back(load_surface_for(file_path, window_surface_ptr));
+    }
+    catch (...)
+    {
+        for (SDL_Surface* sprite : sprites)
+            SDL_FreeSurface(sprite);
+        throw;
+    }
+
+    // Shelves as wide as the widest sprite or the square root of the total
+    // area, whichever is larger
+    const int padding = 1;
+    std::vector<size_t> order(sprites.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(),
+        [&sprites](size_t a, size_t b) { return sprites[a]->h > sprites[b]->h; });
+    int area = 0, widest = 0;
+    for (SDL_Surface* sprite : sprites)
+    {
+        area += (sprite->w + padding) * (sprite->h + padding);
+        widest = std::max(widest, sprite->w + 2 * padding);
+    }
+    int width = std::max(widest, int(std::ceil(std::sqrt(double(area)))));
+    int x = padding, y = padding, shelf_height = 0;
+    std::vector<SDL_Rect> rects(sprites.size());
+    for (size_t i : order)
+    {
+        if (x + sprites[i]->w + padding > width)
+        {
+            x = padding;
+            y += shelf_height + padding;
+            shelf_height = 0;
+        }
+        rects[i] = SDL_Rect{ x, y, sprites[i]->w, sprites[i]->h };
+        x += sprites[i]->w + padding;
+        shelf_height = std::max(shelf_height, sprites[i]->h);
+    }
+    int height = y + shelf_height + padding;
+
+    // Same format as the sprites, which have an alpha channel whenever
+    // their image has one. Textures are usually ARGB8888.
+    Uint32 format = SDL_PIXELFORMAT_ARGB8888;
+    for (SDL_Surface* sprite : sprites)
+    {
+        if (window_surface_ptr && SDL_ISPIXELFORMAT_ALPHA(sprite->format->format))
+            format = sprite->format->format;
+    }
+    surface_ = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, format);
+    if (surface_)
+    {
+        SDL_FillRect(surface_, NULL, SDL_MapRGBA(surface_->format, 0, 0, 0, 0));
+        for (size_t i = 0; i < sprites.size(); i++)
+        {
+            // Copy the alpha channel as is instead of blending it away
+            SDL_SetSurfaceBlendMode(sprites[i], SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(sprites[i], NULL, surface_, &rects[i]);
+            rects_[file_paths[i]] = rects[i];
+        }
+    }
+    for (SDL_Surface* sprite : sprites)
+        SDL_FreeSurface(sprite);
+    if (!surface_)
+        throw std::runtime_error("sprite_atlas(): could not create the atlas: " +
+            std::string(SDL_GetError()));
+    SDL_SetSurfaceBlendMode(surface_, SDL_BLENDMODE_BLEND);
+
+    if (window_surface_ptr && surface_->format->BytesPerPixel == 4 &&
+        surface_->format->Amask == 0xff000000)
+    {
+        // Rounded to the nearest, so that a transparent pixel is all zeros
+        premultiplied_.resize(size_t(surface_->w) * surface_->h);
+        for (int row = 0; row < surface_->h; row++)
+        {
+            const Uint32* pixels = reinterpret_cast<const Uint32*>(
+                static_cast<const Uint8*>(surface_->pixels) + row * surface_->pitch);
+            Uint32* premultiplied = premultiplied_.data() + size_t(row) * surface_->w;
+            for (int column = 0; column < surface_->w; column++)
+            {
+                Uint32 pixel = pixels[column], alpha = pixel >> 24;
+                Uint32 result = alpha << 24;
+                for (int shift = 0; shift < 24; shift += 8)
+                    result |= ((pixel >> shift & 0xff) * alpha * 2 + 255) / 510 << shift;
+                premultiplied[column] = result;
+            }
+        }
+    }
+
+    if (renderer_ptr)
+    {
+        texture_ = SDL_CreateTextureFromSurface(renderer_ptr, surface_);
+        if (!texture_)
+        {
+            SDL_FreeSurface(surface_);
+            throw std::runtime_error("sprite_atlas(): could not create texture: " +
+                std::string(SDL_GetError()));
+        }
+        SDL_SetTextureBlendMode(texture_, SDL_BLENDMODE_BLEND);
+    }
+}
+
+sprite_atlas::~sprite_atlas() {
+    if (texture_)
+        SDL_DestroyTexture(texture_);
+    SDL_FreeSurface(surface_);
+}
+
+SDL_Surface* sprite_atlas::surface() const {
+    return surface_;
+}
+
+SDL_Texture* sprite_atlas::texture() const {
+    return texture_;
+}
+
+const Uint32* sprite_atlas::premultiplied() const {
+    return premultiplied_.empty() ? NULL : premultiplied_.data();
+}
+
+const SDL_Rect& sprite_atlas::rect(const std::string& file_path) const {
+    auto rect = rects_.find(file_path);
+    if (rect == rects_.end())
+        throw std::runtime_error("sprite_atlas::rect(): " + file_path + " is not in the atlas");
+    return rect->second;
+}
+
 // ---------------- animal class impl ----------------
 
-int animal::getRandomSpawn(DIRECTION dir) {
-    std::random_device                  rand_dev;
-    std::mt19937                        generator(rand_dev());
-    if (dir == DIRECTION::HORIZONTAL)
+int animal::getRandomSpawn(random_generator& generator, int world_size, int boundary) {
+    return generator.between(boundary, world_size - boundary);
+}
+
+int animal::getRandomTarget(random_generator& generator, int position,
+    int bounding, int world_size, int boundary) {
+    int lower = boundary;
+    int upper = world_size - boundary;
+    int min, max;
+    // In 64 bits, the radius may be as large as any int
+    if (Sint64(position) - bounding <= lower)
+    {
+        min = lower;
+    }
+    else
+    {
+        min = position - bounding;
+    }
+
+    if (Sint64(position) + bounding >= upper) {
+        max = upper;
+    }
+    else
+    {
+        max = position + bounding;
+    }
+    return generator.between(min, max);
+}
+
+animal::animal(const std::string& file_path, const sprite_atlas* atlas,
+    SDL_Surface* window_surface_ptr) {
+    atlas_ = atlas;
+    sprite_rect_ = atlas ? atlas->rect(file_path) : SDL_Rect{ 0, 0, 0, 0 };
+    window_surface_ptr_ = window_surface_ptr;
+    blend_ = atlas && window_surface_ptr && can_blend(*atlas, window_surface_ptr);
+    impostor_color_ = SDL_Color{ 0, 0, 0, 255 };
+    if (atlas)
+    {
+        // Average of the sprite pixels weighted by their alpha, the atlas
+        // always has 32 bit pixels
+        const SDL_Surface* surface = atlas->surface();
+        Uint64 red = 0, green = 0, blue = 0, weight = 0;
+        for (int row = 0; row < sprite_rect_.h; row++)
+        {
+            const Uint32* pixels = reinterpret_cast<const Uint32*>(
+                static_cast<const Uint8*>(surface->pixels) +
+                (sprite_rect_.y + row) * surface->pitch) + sprite_rect_.x;
+            for (int column = 0; column < sprite_rect_.w; column++)
+            {
+                Uint8 r, g, b, a;
+                SDL_GetRGBA(pixels[column], surface->format, &r, &g, &b, &a);
+                red += Uint64(r) * a;
+                green += Uint64(g) * a;
+                blue += Uint64(b) * a;
+                weight += a;
+            }
+        }
+        if (weight)
+            impostor_color_ = SDL_Color{ Uint8(red / weight), Uint8(green / weight),
+                Uint8(blue / weight), 255 };
+    }
+    retarget_radius_ = default_retarget_radius;
+    sight_radius_ = 0;
+    prey_ = SPECIES_COUNT;
+    predator_ = SPECIES_COUNT;
+};
+
+animal::~animal() {
+};
+
+int animal::width() const {
+    return sprite_rect_.w;
+}
+
+int animal::height() const {
+    return sprite_rect_.h;
+}
+
+int animal::retarget_radius() const {
+    return retarget_radius_;
+}
+
+void animal::set_retarget_radius(int radius) {
+    retarget_radius_ = radius;
+}
+
+int animal::sight_radius() const {
+    return sight_radius_;
+}
+
+SPECIES animal::prey() const {
+    return prey_;
+}
+
+SPECIES animal::predator() const {
+    return predator_;
+}
+
+void animal::draw(int x, int y) const {
+    // The atlas already has the window format and the sprites their
+    // on-screen size, so a plain blit is enough.
+    if (blend_)
+    {
+        bool locked = SDL_MUSTLOCK(window_surface_ptr_);
+        if (locked && SDL_LockSurface(window_surface_ptr_) < 0)
+            throw std::runtime_error("animal::draw(): could not lock the window surface: " +
+                std::string(SDL_GetError()));
+        blend_sprite(*atlas_, sprite_rect_, window_surface_ptr_, x, y,
+            window_surface_ptr_->clip_rect);
+        if (locked)
+            SDL_UnlockSurface(window_surface_ptr_);
+        return;
+    }
+    SDL_Rect source = sprite_rect_;
+    SDL_Rect destination = SDL_Rect{ x, y, sprite_rect_.w, sprite_rect_.h };
+    SDL_BlitSurface(atlas_->surface(), &source, window_surface_ptr_, &destination);
+};
+
+void animal::draw(const SDL_Rect& destination) const {
+    SDL_Rect source = sprite_rect_;
+    SDL_Rect stretched = destination;
+    SDL_BlitScaled(atlas_->surface(), &source, window_surface_ptr_, &stretched);
+}
+
+const SDL_Rect& animal::sprite_rect() const {
+    return sprite_rect_;
+}
+
+const SDL_Color& animal::impostor_color() const {
+    return impostor_color_;
+}
+
+// ---------------- sheep class impl ----------------
+const char* const sheep::sprite_path = "./media/sheep.png";
+
+sheep::sheep(const sprite_atlas* atlas, SDL_Surface* window_surface_ptr)
+    : animal(sprite_path, atlas, window_surface_ptr) {
+    sight_radius_ = 60;
+    predator_ = SPECIES::WOLF;
+}
+
+SPECIES sheep::species() const {
+    return SPECIES::SHEEP;
+}
+
+// ---------------- wolf class impl ----------------
+
+const char* const wolf::sprite_path = "./media/wolf.png";
+
+wolf::wolf(const sprite_atlas* atlas, SDL_Surface* window_surface_ptr)
+    : animal(sprite_path, atlas, window_surface_ptr) {
+    sight_radius_ = 150;
+    prey_ = SPECIES::SHEEP;
+}
+
+SPECIES wolf::species() const {
+    return SPECIES::WOLF;
+}
+
+// ---------------- command_buffer class impl ----------------
+
+void command_buffer::add_animal(SPECIES species) {
+    commands_.push_back(command{ animal_handle{ no_index, 0 }, species });
+}
+
+void command_buffer::remove_animal(animal_handle handle) {
+    commands_.push_back(command{ handle, SPECIES_COUNT });
+}
+
+const std::vector<command_buffer::command>& command_buffer::commands() const {
+    return commands_;
+}
+
+bool command_buffer::empty() const {
+    return commands_.empty();
+}
+
+void command_buffer::clear() {
+    commands_.clear();
+}
+
+// ---------------- ground class impl ----------------
+
+ground::ground(SDL_Surface* window_surface_ptr, SDL_Renderer* renderer_ptr, Uint64 seed,
+    unsigned thread_count, const run_config& config)
+    : generator_(seed) {
+    Uint64 world_width = config.world_width ? config.world_width : config.frame_width;
+    Uint64 world_height = config.world_height ? config.world_height : config.frame_height;
+    // Animals spawn at least frame_boundary pixels away from the borders
+    if (world_width <= 2 * Uint64(config.frame_boundary) ||
+        world_height <= 2 * Uint64(config.frame_boundary) ||
+        world_width > max_world_size || world_height > max_world_size)
+        throw std::runtime_error("ground(): the world must be larger than " +
+            std::to_string(2 * Uint64(config.frame_boundary)) + " pixels and at most " +
+            std::to_string(max_world_size) + " pixels on each side");
+    world_width_ = int(world_width);
+    world_height_ = int(world_height);
+    view_width_ = int(config.frame_width);
+    view_height_ = int(config.frame_height);
+    window_surface_ptr_ = window_surface_ptr;
+    renderer_ptr_ = renderer_ptr;
+    seed_ = seed;
+    workers_ = std::make_unique<worker_pool>(std::max(thread_count, 1u));
+    move_kernel_ = fastest_simd_level();
+    if (window_surface_ptr_ || renderer_ptr_)
+        atlas_ = std::make_unique<sprite_atlas>(
+            std::vector<std::string>{ sheep::sprite_path, wolf::sprite_path },
+            window_surface_ptr_, renderer_ptr_);
+    species_[SPECIES::SHEEP] = std::make_unique<sheep>(atlas_.get(), window_surface_ptr_);
+    species_[SPECIES::WOLF] = std::make_unique<wolf>(atlas_.get(), window_surface_ptr_);
+    configure(int(config.frame_boundary), config.retarget_radius);
+    tile_columns_ = (view_width_ + dirty_tile_size - 1) / dirty_tile_size;
+    tile_rows_ = (view_height_ + dirty_tile_size - 1) / dirty_tile_size;
+    dirty_tiles_.assign(size_t(tile_columns_) * tile_rows_, 0);
+    dirty_tile_count_ = 0;
+    full_repaint_ = true;
+    background_color_ = window_surface_ptr_ ?
+        SDL_MapRGB(window_surface_ptr_->format, 0, 255, 0) : 0;
+    compositor_ = window_surface_ptr_ && can_blend(*atlas_, window_surface_ptr_);
+    lod_coverage_ = lod_coverage;
+    lod_ = false;
+    for (size_t species = 0; species < SPECIES_COUNT; species++)
+    {
+        species_count_[species] = 0;
+        grids_.emplace_back(world_width_, world_height_, grid_cell_size);
+    }
+    grids_dirty_ = true;
+    steps_since_visible_ = 0;
+    set_camera((world_width_ - double(view_width_)) / 2,
+        (world_height_ - double(view_height_)) / 2, 1);
+}
+
+void ground::configure(int boundary, int retarget_radius) {
+    boundary_ = boundary;
+    for (const std::unique_ptr<animal>& description : species_)
+        description->set_retarget_radius(retarget_radius);
+    default_config_ = boundary == int(frame_boundary) &&
+        retarget_radius == default_retarget_radius;
+}
+
+ground::~ground() {
+};
+
+animal_handle ground::add_animal(SPECIES species) {
+    int radius = species_[species]->retarget_radius();
+    int x = animal::getRandomSpawn(generator_, world_width_, boundary_);
+    int y = animal::getRandomSpawn(generator_, world_height_, boundary_);
+
+    x_.push_back(x);
+    y_.push_back(y);
+    previous_x_.push_back(x);
+    previous_y_.push_back(y);
+    drawn_x_.push_back(x);
+    drawn_y_.push_back(y);
+    full_repaint_ = true;
+    target_x_.push_back(animal::getRandomTarget(generator_, x, radius, world_width_, boundary_));
+    target_y_.push_back(animal::getRandomTarget(generator_, y, radius, world_height_, boundary_));
+    species_of_.push_back(species);
+    rest_.push_back(0);
+    species_count_[species]++;
+    grids_dirty_ = true;
+
+    Uint32 entry;
+    if (free_entries_.empty())
+    {
+        entry = Uint32(entry_index_.size());
+        entry_index_.push_back(no_index);
+        entry_generation_.push_back(0);
+    }
+    else
+    {
+        entry = free_entries_.back();
+        free_entries_.pop_back();
+    }
+    entry_index_[entry] = Uint32(handle_entry_.size());
+    handle_entry_.push_back(entry);
+    return animal_handle{ entry, entry_generation_[entry] };
+}
+
+void ground::remove_animal(animal_handle handle) {
+    if (!alive(handle))
+        return;
+    size_t index = entry_index_[handle.entry];
+    size_t last = x_.size() - 1;
+    species_count_[species_of_[index]]--;
+    // The last animal is now drawn at another point of the drawing order,
+    // so where it stands has to be repainted as well
+    if (window_surface_ptr_)
+    {
+        vacated_rects_.push_back(drawn_rect(index));
+        vacated_rects_.push_back(drawn_rect(last));
+    }
+
+    x_[index] = x_[last];
+    y_[index] = y_[last];
+    previous_x_[index] = previous_x_[last];
+    previous_y_[index] = previous_y_[last];
+    drawn_x_[index] = drawn_x_[last];
+    drawn_y_[index] = drawn_y_[last];
+    target_x_[index] = target_x_[last];
+    target_y_[index] = target_y_[last];
+    species_of_[index] = species_of_[last];
+    rest_[index] = rest_[last];
+    handle_entry_[index] = handle_entry_[last];
+    entry_index_[handle_entry_[index]] = Uint32(index);
+
+    x_.pop_back();
+    y_.pop_back();
+    previous_x_.pop_back();
+    previous_y_.pop_back();
+    drawn_x_.pop_back();
+    drawn_y_.pop_back();
+    target_x_.pop_back();
+    target_y_.pop_back();
+    species_of_.pop_back();
+    rest_.pop_back();
+    handle_entry_.pop_back();
+
+    entry_index_[handle.entry] = no_index;
+    entry_generation_[handle.entry]++;
+    free_entries_.push_back(handle.entry);
+    grids_dirty_ = true;
+    // The index of the last animal changed, find_visible looks again
+    visible_.clear();
+}
+
+void ground::remove_animals(const animal_handle* handles, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        remove_animal(handles[i]);
+}
+
+void ground::queue_add_animal(SPECIES species) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    queued_commands_.add_animal(species);
+}
+
+void ground::queue_remove_animal(animal_handle handle) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    queued_commands_.remove_animal(handle);
+}
+
+void ground::apply(command_buffer& commands) {
+    for (const command_buffer::command& command : commands.commands())
+    {
+        if (command.species == SPECIES_COUNT)
+            remove_animal(command.handle);
+        else
+            add_animal(command.species);
+    }
+    commands.clear();
+}
+
+void ground::reserve(size_t count) {
+    x_.reserve(count);
+    y_.reserve(count);
+    previous_x_.reserve(count);
+    previous_y_.reserve(count);
+    drawn_x_.reserve(count);
+    drawn_y_.reserve(count);
+    target_x_.reserve(count);
+    target_y_.reserve(count);
+    species_of_.reserve(count);
+    rest_.reserve(count);
+    handle_entry_.reserve(count);
+    entry_index_.reserve(count);
+    entry_generation_.reserve(count);
+}
+
+size_t ground::size() const {
+    return x_.size();
+}
+
+size_t ground::memory_used() const {
+    return (x_.capacity() + y_.capacity() + previous_x_.capacity() + previous_y_.capacity() +
+        drawn_x_.capacity() + drawn_y_.capacity() + target_x_.capacity() +
+        target_y_.capacity()) * sizeof(int) +
+        (species_of_.capacity() + arrived_.capacity()) * sizeof(Uint8) +
+        rest_.capacity() * sizeof(Uint16) +
+        (handle_entry_.capacity() + entry_index_.capacity() + entry_generation_.capacity() +
+        free_entries_.capacity()) * sizeof(Uint32);
+}
+
+bool ground::alive(animal_handle handle) const {
+    return handle.entry < entry_index_.size() && entry_index_[handle.entry] != no_index &&
+        entry_generation_[handle.entry] == handle.generation;
+}
+
+long ground::index_of(animal_handle handle) const {
+    return alive(handle) ? long(entry_index_[handle.entry]) : -1;
+}
+
+animal_handle ground::handle_of(Uint32 index) const {
+    Uint32 entry = handle_entry_[index];
+    return animal_handle{ entry, entry_generation_[entry] };
+}
+
+size_t ground::count(SPECIES species) const {
+    return species_count_[species];
+}
+
+void ground::set_move_kernel(SIMD_LEVEL kernel) {
+    move_kernel_ = kernel;
+}
+
+SIMD_LEVEL ground::move_kernel() const {
+    return move_kernel_;
+}
+
+unsigned ground::thread_count() const {
+    return workers_->thread_count();
+}
+
+template <bool default_config>
+void ground::retarget_with(random_generator& generator, const Uint32* indices,
+    size_t count) {
+    for (size_t k = 0; k < count; k++)
+    {
+        Uint32 i = indices[k];
+        int radius = default_config ? default_retarget_radius :
+            species_[species_of_[i]]->retarget_radius();
+        int boundary = default_config ? int(frame_boundary) : boundary_;
+        target_x_[i] = animal::getRandomTarget(generator, x_[i], radius, world_width_, boundary);
+        target_y_[i] = animal::getRandomTarget(generator, y_[i], radius, world_height_, boundary);
+    }
+}
+
+void ground::retarget(random_generator& generator, const Uint32* indices,
+    size_t count) {
+    if (default_config_)
+        retarget_with<true>(generator, indices, count);
+    else
+        retarget_with<false>(generator, indices, count);
+}
+
+void ground::retarget(const Uint32* indices, size_t count) {
+    retarget(generator_, indices, count);
+}
+
+int ground::world_width() const {
+    return world_width_;
+}
+
+int ground::world_height() const {
+    return world_height_;
+}
+
+int ground::boundary() const {
+    return boundary_;
+}
+
+int ground::retarget_radius() const {
+    return species_[0]->retarget_radius();
+}
+
+void ground::set_camera(double x, double y, double zoom) {
+    zoom_ = std::clamp(zoom, min_zoom, max_zoom);
+    // Back at the original size the camera sits on whole pixels, so that
+    // sprites are copied as they are
+    if (std::abs(zoom_ - 1) < 1e-9)
+    {
+        zoom_ = 1;
+        x = std::round(x);
+        y = std::round(y);
+    }
+    double view_width = view_width_ / zoom_, view_height = view_height_ / zoom_;
+    camera_x_ = view_width >= world_width_ ? (world_width_ - view_width) / 2 :
+        std::clamp(x, 0., world_width_ - view_width);
+    camera_y_ = view_height >= world_height_ ? (world_height_ - view_height) / 2 :
+        std::clamp(y, 0., world_height_ - view_height);
+    if (zoom_ == 1)
+    {
+        camera_x_ = std::floor(camera_x_);
+        camera_y_ = std::floor(camera_y_);
+    }
+    // Every animal moved in the window
+    full_repaint_ = true;
+}
+
+void ground::pan(double dx, double dy) {
+    set_camera(camera_x_ + dx / zoom_, camera_y_ + dy / zoom_, zoom_);
+}
+
+void ground::zoom_at(double factor, int x, int y) {
+    double world_x = camera_x_ + x / zoom_, world_y = camera_y_ + y / zoom_;
+    double zoom = std::clamp(zoom_ * factor, min_zoom, max_zoom);
+    set_camera(world_x - x / zoom, world_y - y / zoom, zoom);
+}
+
+double ground::camera_x() const {
+    return camera_x_;
+}
+
+double ground::camera_y() const {
+    return camera_y_;
+}
+
+double ground::zoom() const {
+    return zoom_;
+}
+
+void ground::steer_chunk(size_t chunk) {
+    size_t begin = chunk * chunk_size;
+    size_t end = std::min(begin + chunk_size, x_.size());
+    command_buffer& commands = chunk_commands_[chunk];
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const animal& description = *species_[species_of_[i]];
+        if (description.prey() != SPECIES_COUNT && rest_[i])
+            rest_[i]--;
+        else if (description.prey() != SPECIES_COUNT)
+        {
+            long prey = nearest(x_[i], y_[i], description.sight_radius(), description.prey());
+            if (prey >= 0)
+            {
+                target_x_[i] = x_[prey];
+                target_y_[i] = y_[prey];
+                int dx = x_[prey] - x_[i], dy = y_[prey] - y_[i];
+                // Every predator which caught the prey rests, even those
+                // whose removal of it comes second
+                if (dx * dx + dy * dy <= eat_distance * eat_distance)
+                {
+                    commands.remove_animal(handle_of(Uint32(prey)));
+                    rest_[i] = hunt_cooldown;
+                }
+                continue;
+            }
+        }
+        if (description.predator() != SPECIES_COUNT)
+        {
+            long predator = nearest(x_[i], y_[i], description.sight_radius(), description.predator());
+            if (predator >= 0)
+            {
+                // Run straight away from the predator, as far as a usual
+                // target, in 64 bits as the radius may be as large as any int
+                Sint64 dx = x_[i] - x_[predator], dy = y_[i] - y_[predator];
+                Sint64 longest = std::max(std::max(std::abs(dx), std::abs(dy)), Sint64(1));
+                Sint64 radius = description.retarget_radius();
+                target_x_[i] = int(std::clamp(x_[i] + dx * radius / longest,
+                    Sint64(boundary_), Sint64(world_width_ - boundary_)));
+                target_y_[i] = int(std::clamp(y_[i] + dy * radius / longest,
+                    Sint64(boundary_), Sint64(world_height_ - boundary_)));
+            }
+        }
+    }
+}
+
+void ground::move_chunk(size_t chunk) {
+    size_t begin = chunk * chunk_size;
+    size_t count = std::min(chunk_size, x_.size() - begin);
+    int* x = x_.data() + begin;
+    int* y = y_.data() + begin;
+    int* target_x = target_x_.data() + begin;
+    int* target_y = target_y_.data() + begin;
+    Uint8* arrived = arrived_.data() + begin;
+    std::copy(x, x + count, previous_x_.begin() + begin);
+    std::copy(y, y + count, previous_y_.begin() + begin);
+
+    switch (move_kernel_)
+    {
+#ifdef SIMD_X86
+    case SIMD_LEVEL::AVX2:
+        move_avx2(x, y, target_x, target_y, arrived, count);
+        break;
+    case SIMD_LEVEL::SSE2:
+        move_sse2(x, y, target_x, target_y, arrived, count);
+        break;
+#endif
+    default:
+        move_scalar(x, y, target_x, target_y, arrived, count);
+        break;
+    }
+
+    std::vector<Uint32>& retarget_list = chunk_retarget_lists_[chunk];
+    retarget_list.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+        if (arrived[i])
+            retarget_list.push_back(Uint32(begin + i));
+    }
+    retarget(chunk_generators_[chunk], retarget_list.data(), retarget_list.size());
+}
+
+void ground::move() {
+    steps_since_visible_++;
+    size_t chunk_count = (x_.size() + chunk_size - 1) / chunk_size;
+    arrived_.resize(x_.size());
+    chunk_retarget_lists_.resize(chunk_count);
+    chunk_commands_.resize(chunk_count);
+    // Stream 0 belongs to generator_, chunk c uses stream c + 1
+    while (chunk_generators_.size() < chunk_count)
+        chunk_generators_.emplace_back(seed_, chunk_generators_.size() + 1);
+
+    if (grids_dirty_)
+        rebuild_grids();
+
+    // Steering reads the positions of the other animals, so every chunk has
+    // to be steered before any of them moves
+    workers_->parallel_for(chunk_count, [this](size_t chunk) { steer_chunk(chunk); });
+    workers_->parallel_for(chunk_count, [this](size_t chunk) { move_chunk(chunk); });
+
+    // One chunk after the other so that the outcome does not depend on the
+    // threads. Several predators may have caught the same prey, it is only
+    // removed once.
+    for (command_buffer& commands : chunk_commands_)
+        apply(commands);
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        std::swap(queued_commands_, applied_commands_);
+    }
+    apply(applied_commands_);
+    rebuild_grids();
+}
+
+void ground::rebuild_grids() {
+    for (size_t species = 0; species < SPECIES_COUNT; species++)
+        grids_[species].rebuild(x_.data(), y_.data(), species_of_.data(),
+            SPECIES(species), x_.size());
+    grids_dirty_ = false;
+}
+
+SDL_Point ground::position(Uint32 index) const {
+    return SDL_Point{ x_[index], y_[index] };
+}
+
+SPECIES ground::species_of(Uint32 index) const {
+    return SPECIES(species_of_[index]);
+}
+
+void ground::query_radius(int x, int y, int radius, std::vector<Uint32>& result) const {
+    result.clear();
+    Sint64 radius_squared = Sint64(radius) * radius;
+    for (const spatial_grid& grid : grids_)
+    {
+        int first_column = grid.column_of(x - radius), last_column = grid.column_of(x + radius);
+        int first_row = grid.row_of(y - radius), last_row = grid.row_of(y + radius);
+        for (int row = first_row; row <= last_row; row++)
+        {
+            for (int column = first_column; column <= last_column; column++)
+            {
+                for (const Uint32* it = grid.cell_begin(column, row); it != grid.cell_end(column, row); ++it)
+                {
+                    Sint64 dx = x_[*it] - x, dy = y_[*it] - y;
+                    if (dx * dx + dy * dy < radius_squared)
+                        result.push_back(*it);
+                }
+            }
+        }
+    }
+}
+
+long ground::nearest(int x, int y, int radius, SPECIES species) const {
+    const spatial_grid& grid = grids_[species];
+    long best = -1;
+    Sint64 best_distance = Sint64(radius) * radius;
+    auto visit_cell = [&](int column, int row) {
+        for (const Uint32* it = grid.cell_begin(column, row); it != grid.cell_end(column, row); ++it)
+        {
+            Sint64 dx = x_[*it] - x, dy = y_[*it] - y;
+            Sint64 distance = dx * dx + dy * dy;
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                best = long(*it);
+            }
+        }
+    };
+
+    // Visit the cells ring by ring around the cell of (x, y). Once the best
+    // candidate is closer than the border of the square of visited cells,
+    // nothing further away can beat it and the search is over.
+    int center_column = grid.column_of(x), center_row = grid.row_of(y);
+    int max_ring = radius / grid.cell_size() + 1;
+    for (int ring = 0; ring <= max_ring; ring++)
+    {
+        int first_row = center_row - ring, last_row = center_row + ring;
+        int first_column = center_column - ring, last_column = center_column + ring;
+        int first_inside_column = std::max(first_column, 0);
+        int last_inside_column = std::min(last_column, grid.columns() - 1);
+        for (int row = std::max(first_row, 0); row <= std::min(last_row, grid.rows() - 1); row++)
+        {
+            if (row == first_row || row == last_row)
+            {
+                for (int column = first_inside_column; column <= last_inside_column; column++)
+                    visit_cell(column, row);
+            }
+            else
+            {
+                if (first_column >= 0)
+                    visit_cell(first_column, row);
+                if (last_column < grid.columns())
+                    visit_cell(last_column, row);
+            }
+        }
+
+        int cell_size = grid.cell_size();
+        Sint64 covered = std::min(std::min(x - first_column * cell_size, (last_column + 1) * cell_size - x),
+            std::min(y - first_row * cell_size, (last_row + 1) * cell_size - y));
+        if (best >= 0 && covered > 0 && best_distance <= covered * covered)
+            break;
+    }
+    return best;
+}
+
+void ground::set_lod_coverage(double coverage) {
+    lod_coverage_ = coverage;
+}
+
+bool ground::lod() const {
+    return lod_;
+}
+
+bool ground::choose_lod() const {
+    if (lod_coverage_ <= 0)
+        return false;
+    // Only what the camera sees counts, the sprites of the animals found by
+    // find_visible spread over the part of the world in the window. Zooming
+    // scales the sprites and that area alike.
+    size_t counts[SPECIES_COUNT] = {};
+    if (visible_.size() == x_.size())
+        std::copy(species_count_, species_count_ + SPECIES_COUNT, counts);
+    else
+    {
+        for (Uint32 i : visible_)
+            counts[species_of_[i]]++;
+    }
+    double covered = 0;
+    for (size_t species = 0; species < SPECIES_COUNT; species++)
+        covered += double(counts[species]) * species_[species]->width() *
+            species_[species]->height();
+    double width = std::min(camera_x_ + view_width_ / zoom_, double(world_width_)) -
+        std::max(camera_x_, 0.);
+    double height = std::min(camera_y_ + view_height_ / zoom_, double(world_height_)) -
+        std::max(camera_y_, 0.);
+    return covered > lod_coverage_ * std::max(width, 1.) * std::max(height, 1.);
+}
+
+void ground::find_visible() {
+    // Animals are indexed by their top left corner, so look as far as the
+    // largest sprite beyond the window, plus a pixel for the interpolation
+    // between two steps. An animal drawn in the window at the last call
+    // has to be found again so that draw_dirty repaints where it was: each
+    // step since moved it by at most a pixel along each axis.
+    int reach = 1 + int(std::min(steps_since_visible_, Uint32(SDL_MAX_SINT32 / 4)));
+    steps_since_visible_ = 0;
+    int margin = reach;
+    for (const std::unique_ptr<animal>& description : species_)
+        margin = std::max(margin, std::max(description->width(), description->height()) + reach);
+    int left = int(std::floor(camera_x_)) - margin;
+    int top = int(std::floor(camera_y_)) - margin;
+    int right = int(std::ceil(camera_x_ + view_width_ / zoom_)) + reach;
+    int bottom = int(std::ceil(camera_y_ + view_height_ / zoom_)) + reach;
+
+    visible_.clear();
+    if (left <= 0 && top <= 0 && right >= world_width_ && bottom >= world_height_)
+    {
+        visible_.resize(x_.size());
+        std::iota(visible_.begin(), visible_.end(), Uint32(0));
+        return;
+    }
+    if (grids_dirty_)
+        rebuild_grids();
+    for (const spatial_grid& grid : grids_)
+    {
+        int first_column = grid.column_of(left), last_column = grid.column_of(right);
+        int first_row = grid.row_of(top), last_row = grid.row_of(bottom);
+        for (int row = first_row; row <= last_row; row++)
+        {
+            for (int column = first_column; column <= last_column; column++)
+                visible_.insert(visible_.end(), grid.cell_begin(column, row),
+                    grid.cell_end(column, row));
+        }
+    }
+    std::sort(visible_.begin(), visible_.end());
+}
+
+SDL_Rect ground::screen_rect(size_t index, int weight) const {
+    // Fixed point blend, positions differ by at most a few pixels
+    int x = previous_x_[index] + (((x_[index] - previous_x_[index]) * weight + 128) >> 8);
+    int y = previous_y_[index] + (((y_[index] - previous_y_[index]) * weight + 128) >> 8);
+    const animal& description = *species_[species_of_[index]];
+    return SDL_Rect{ int(std::floor((x - camera_x_) * zoom_)),
+        int(std::floor((y - camera_y_) * zoom_)),
+        std::max(int(description.width() * zoom_ + .5), 1),
+        std::max(int(description.height() * zoom_ + .5), 1) };
+}
+
+void ground::draw_sprite(size_t index, const SDL_Rect& rect) const {
+    const animal& description = *species_[species_of_[index]];
+    if (zoom_ == 1)
+        description.draw(rect.x, rect.y);
+    else
+        description.draw(rect);
+}
+
+void ground::draw(double interpolation) {
+    // The caller repaints the whole window, which does away with what the
+    // removed animals left behind. Nothing tracks what is drawn here, so a
+    // later draw_dirty has to repaint everything.
+    vacated_rects_.clear();
+    full_repaint_ = true;
+    find_visible();
+    lod_ = choose_lod();
+    if (lod_)
+    {
+        draw_impostors(interpolation);
+        return;
+    }
+    if (renderer_ptr_)
+    {
+        draw_batched(interpolation);
+        return;
+    }
+
+    int weight = int(interpolation * 256);
+    for (Uint32 i : visible_)
+    {
+        SDL_Rect rect = screen_rect(i, weight);
+        if (rect.x < view_width_ && rect.y < view_height_ &&
+            rect.x + rect.w > 0 && rect.y + rect.h > 0)
+            draw_sprite(i, rect);
+    }
+}
+
+void ground::draw_batched(double interpolation) {
+    int weight = int(interpolation * 256);
+    SDL_Texture* texture = atlas_->texture();
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    // Two textured triangles per animal, all in one SDL_RenderGeometry call
+    // since every species comes from the atlas
+    const SDL_Surface* atlas_surface = atlas_->surface();
+    float u_scale = 1.f / atlas_surface->w, v_scale = 1.f / atlas_surface->h;
+    batch_vertices_.clear();
+    batch_indices_.clear();
+    for (Uint32 i : visible_)
+    {
+        const SDL_Rect& sprite = species_[species_of_[i]]->sprite_rect();
+        SDL_Rect rect = screen_rect(i, weight);
+        if (rect.x >= view_width_ || rect.y >= view_height_ ||
+            rect.x + rect.w <= 0 || rect.y + rect.h <= 0)
+            continue;
+        float x = float(rect.x), y = float(rect.y);
+        float w = float(rect.w), h = float(rect.h);
+        float u0 = sprite.x * u_scale, v0 = sprite.y * v_scale;
+        float u1 = (sprite.x + sprite.w) * u_scale, v1 = (sprite.y + sprite.h) * v_scale;
+
+        int first = int(batch_vertices_.size());
+        SDL_Color white = { 255, 255, 255, 255 };
+        batch_vertices_.push_back(SDL_Vertex{ { x, y }, white, { u0, v0 } });
+        batch_vertices_.push_back(SDL_Vertex{ { x + w, y }, white, { u1, v0 } });
+        batch_vertices_.push_back(SDL_Vertex{ { x + w, y + h }, white, { u1, v1 } });
+        batch_vertices_.push_back(SDL_Vertex{ { x, y + h }, white, { u0, v1 } });
+        int corners[6] = { first, first + 1, first + 2, first, first + 2, first + 3 };
+        batch_indices_.insert(batch_indices_.end(), corners, corners + 6);
+    }
+    if (!batch_indices_.empty())
+        SDL_RenderGeometry(renderer_ptr_, texture, batch_vertices_.data(),
+            int(batch_vertices_.size()), batch_indices_.data(), int(batch_indices_.size()));
+#else
+    // No geometry API: every copy uses the atlas texture, so SDL's render
+    // batching merges them into one submission
+    for (Uint32 i : visible_)
+    {
+        const SDL_Rect& sprite = species_[species_of_[i]]->sprite_rect();
+        SDL_Rect rect = screen_rect(i, weight);
+        if (rect.x >= view_width_ || rect.y >= view_height_ ||
+            rect.x + rect.w <= 0 || rect.y + rect.h <= 0)
+            continue;
+        SDL_RenderCopy(renderer_ptr_, texture, &sprite, &rect);
+    }
+#endif
+}
+
+void ground::draw_impostors(double interpolation) {
+    int weight = int(interpolation * 256);
+    if (renderer_ptr_)
+    {
+        // One batch of points per species, as each has its own color
+        for (size_t species = 0; species < SPECIES_COUNT; species++)
+        {
+            const animal& description = *species_[species];
+            impostor_points_.clear();
+            for (Uint32 i : visible_)
+            {
+                if (species_of_[i] != species)
+                    continue;
+                SDL_Rect rect = screen_rect(i, weight);
+                impostor_points_.push_back(SDL_Point{ rect.x + rect.w / 2, rect.y + rect.h / 2 });
+            }
+            if (impostor_points_.empty())
+                continue;
+            const SDL_Color& color = description.impostor_color();
+            SDL_SetRenderDrawColor(renderer_ptr_, color.r, color.g, color.b, color.a);
+            SDL_RenderDrawPoints(renderer_ptr_, impostor_points_.data(),
+                int(impostor_points_.size()));
+        }
+        return;
+    }
+
+    Uint32 colors[SPECIES_COUNT];
+    for (size_t species = 0; species < SPECIES_COUNT; species++)
     {
-        std::uniform_int_distribution<int>  distr(frame_boundary, frame_width - frame_boundary);
-        return distr(generator);
+        const SDL_Color& color = species_[species]->impostor_color();
+        colors[species] = SDL_MapRGB(window_surface_ptr_->format, color.r, color.g, color.b);
     }
-    else
+    const SDL_Rect& clip = window_surface_ptr_->clip_rect;
+    bool direct = window_surface_ptr_->format->BytesPerPixel == 4;
+    bool locked = direct && SDL_MUSTLOCK(window_surface_ptr_);
+    if (locked && SDL_LockSurface(window_surface_ptr_) < 0)
+        throw std::runtime_error("ground::draw_impostors(): could not lock the window surface: " +
+            std::string(SDL_GetError()));
+    for (Uint32 i : visible_)
     {
-        std::uniform_int_distribution<int>  distr(frame_boundary, frame_height - frame_boundary);
-        return distr(generator);
+        SDL_Rect rect = screen_rect(i, weight);
+        int x = rect.x + rect.w / 2, y = rect.y + rect.h / 2;
+        if (x < clip.x || y < clip.y || x >= clip.x + clip.w || y >= clip.y + clip.h)
+            continue;
+        if (direct)
+            reinterpret_cast<Uint32*>(static_cast<Uint8*>(window_surface_ptr_->pixels) +
+                y * window_surface_ptr_->pitch)[x] = colors[species_of_[i]];
+        else
+        {
+            SDL_Rect pixel = { x, y, 1, 1 };
+            SDL_FillRect(window_surface_ptr_, &pixel, colors[species_of_[i]]);
+        }
     }
+    if (locked)
+        SDL_UnlockSurface(window_surface_ptr_);
 }
 
-int animal::getRandomTarget(int bounding, DIRECTION dir) {
-    int min, max;
-    if (dir == DIRECTION::HORIZONTAL)
+SDL_Rect ground::drawn_rect(size_t index) const {
+    const animal& description = *species_[species_of_[index]];
+    return SDL_Rect{ drawn_x_[index], drawn_y_[index],
+        std::max(int(description.width() * zoom_ + .5), 1),
+        std::max(int(description.height() * zoom_ + .5), 1) };
+}
+
+void ground::mark_dirty(const SDL_Rect& rect) {
+    int first_column = std::max(rect.x / dirty_tile_size, 0);
+    int last_column = std::min((rect.x + rect.w - 1) / dirty_tile_size, tile_columns_ - 1);
+    int first_row = std::max(rect.y / dirty_tile_size, 0);
+    int last_row = std::min((rect.y + rect.h - 1) / dirty_tile_size, tile_rows_ - 1);
+    for (int row = first_row; row <= last_row; row++)
     {
-        if (position_.x - bounding <= frame_boundary)
-        {
-            min = frame_boundary;
-        }
-        else
+        for (int column = first_column; column <= last_column; column++)
         {
-            min = position_.x - bounding;
+            Uint8& tile = dirty_tiles_[size_t(row) * tile_columns_ + column];
+            dirty_tile_count_ += !tile;
+            tile = 1;
         }
+    }
+}
+
+bool ground::draw_dirty(double interpolation) {
+    find_visible();
+    lod_ = choose_lod();
+    // Single pixels change all over the frame, repaint everything and
+    // start again from a full repaint when going back to sprites
+    if (lod_)
+    {
+        SDL_FillRect(window_surface_ptr_, NULL, background_color_);
+        draw_impostors(interpolation);
+        vacated_rects_.clear();
+        std::fill(dirty_tiles_.begin(), dirty_tiles_.end(), 0);
+        dirty_tile_count_ = 0;
+        dirty_rects_.clear();
+        full_repaint_ = true;
+        return false;
+    }
+
+    // Find out where each animal goes this frame and which tiles that
+    // touches, both where it was and where it will be. An animal which
+    // left the window since the last frame is still among the visible ones,
+    // see find_visible, so its last drawn pixels are repainted.
+    int weight = int(interpolation * 256);
+    for (const SDL_Rect& rect : vacated_rects_)
+        mark_dirty(rect);
+    vacated_rects_.clear();
+    for (Uint32 i : visible_)
+    {
+        SDL_Rect rect = screen_rect(i, weight);
+        int x = rect.x, y = rect.y;
+        if (x == drawn_x_[i] && y == drawn_y_[i])
+            continue;
+        if (!full_repaint_)
+            mark_dirty(drawn_rect(i));
+        drawn_x_[i] = x;
+        drawn_y_[i] = y;
+        if (!full_repaint_)
+            mark_dirty(drawn_rect(i));
+    }
 
-        if (position_.x + bounding >= frame_width - frame_boundary) {
-            max = frame_width - frame_boundary;
+    dirty_rects_.clear();
+    if (full_repaint_ || dirty_tile_count_ > dirty_repaint_threshold * dirty_tiles_.size())
+    {
+        if (compositor_ && zoom_ == 1)
+        {
+            std::fill(dirty_tiles_.begin(), dirty_tiles_.end(), 1);
+            composite();
         }
         else
         {
-            max = position_.x + bounding;
+            SDL_FillRect(window_surface_ptr_, NULL, background_color_);
+            for (Uint32 i : visible_)
+                draw_sprite(i, drawn_rect(i));
         }
+        std::fill(dirty_tiles_.begin(), dirty_tiles_.end(), 0);
+        dirty_tile_count_ = 0;
+        full_repaint_ = false;
+        return false;
     }
-    else {
-        if (position_.y - bounding <= frame_boundary)
+
+    // One rectangle per run of dirty tiles on each row of tiles
+    for (int row = 0; row < tile_rows_; row++)
+    {
+        const Uint8* tiles = dirty_tiles_.data() + size_t(row) * tile_columns_;
+        for (int column = 0; column < tile_columns_; column++)
         {
-            min = frame_boundary;
+            if (!tiles[column])
+                continue;
+            int first = column;
+            while (column + 1 < tile_columns_ && tiles[column + 1])
+                column++;
+            SDL_Rect rect = { first * dirty_tile_size, row * dirty_tile_size,
+                (column + 1 - first) * dirty_tile_size, dirty_tile_size };
+            rect.w = std::min(rect.w, view_width_ - rect.x);
+            rect.h = std::min(rect.h, view_height_ - rect.y);
+            dirty_rects_.push_back(rect);
         }
-        else
+    }
+    if (compositor_ && zoom_ == 1)
+    {
+        composite();
+        std::fill(dirty_tiles_.begin(), dirty_tiles_.end(), 0);
+        dirty_tile_count_ = 0;
+        return true;
+    }
+
+    SDL_FillRects(window_surface_ptr_, dirty_rects_.data(), int(dirty_rects_.size()),
+        background_color_);
+
+    // Redraw, in the usual order, every animal over a dirty tile, but only
+    // inside the dirty tiles so that the clean ones stay as they are
+    for (Uint32 i : visible_)
+    {
+        SDL_Rect rect = drawn_rect(i);
+        int first_column = std::max(rect.x / dirty_tile_size, 0);
+        int last_column = std::min((rect.x + rect.w - 1) / dirty_tile_size, tile_columns_ - 1);
+        int first_row = std::max(rect.y / dirty_tile_size, 0);
+        int last_row = std::min((rect.y + rect.h - 1) / dirty_tile_size, tile_rows_ - 1);
+        for (int row = first_row; row <= last_row; row++)
         {
-            min = position_.y - bounding;
+            const Uint8* tiles = dirty_tiles_.data() + size_t(row) * tile_columns_;
+            for (int column = first_column; column <= last_column; column++)
+            {
+                if (!tiles[column])
+                    continue;
+                int first = column;
+                while (column + 1 <= last_column && tiles[column + 1])
+                    column++;
+                SDL_Rect clip = { first * dirty_tile_size, row * dirty_tile_size,
+                    (column + 1 - first) * dirty_tile_size, dirty_tile_size };
+                SDL_SetClipRect(window_surface_ptr_, &clip);
+                draw_sprite(i, rect);
+            }
         }
+    }
+    SDL_SetClipRect(window_surface_ptr_, NULL);
 
-        if (position_.y + bounding >= frame_height - frame_boundary) {
-            max = frame_height - frame_boundary;
+    std::fill(dirty_tiles_.begin(), dirty_tiles_.end(), 0);
+    dirty_tile_count_ = 0;
+    return true;
+}
+
+SDL_Rect ground::tile_rect(int column, int row) const {
+    SDL_Rect rect = { column * dirty_tile_size, row * dirty_tile_size,
+        dirty_tile_size, dirty_tile_size };
+    rect.w = std::min(rect.w, view_width_ - rect.x);
+    rect.h = std::min(rect.h, view_height_ - rect.y);
+    return rect;
+}
+
+void ground::composite() {
+    // Bin the animals over the dirty tiles with a counting sort, so that
+    // each bin keeps the drawing order
+    painted_tiles_.clear();
+    for (size_t tile = 0; tile < dirty_tiles_.size(); tile++)
+    {
+        if (dirty_tiles_[tile])
+            painted_tiles_.push_back(Uint32(tile));
+    }
+    tile_bins_.assign(dirty_tiles_.size() + 1, 0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (Uint32 i : visible_)
+        {
+            SDL_Rect rect = drawn_rect(i);
+            int first_column = std::max(rect.x / dirty_tile_size, 0);
+            int last_column = std::min((rect.x + rect.w - 1) / dirty_tile_size, tile_columns_ - 1);
+            int first_row = std::max(rect.y / dirty_tile_size, 0);
+            int last_row = std::min((rect.y + rect.h - 1) / dirty_tile_size, tile_rows_ - 1);
+            for (int row = first_row; row <= last_row; row++)
+            {
+                for (int column = first_column; column <= last_column; column++)
+                {
+                    size_t tile = size_t(row) * tile_columns_ + column;
+                    if (!dirty_tiles_[tile])
+                        continue;
+                    if (pass == 0)
+                        tile_bins_[tile + 1]++;
+                    else
+                        tile_animals_[tile_bins_[tile]++] = i;
+                }
+            }
         }
-        else
+        if (pass == 0)
         {
-            max = position_.y + bounding;
+            std::partial_sum(tile_bins_.begin(), tile_bins_.end(), tile_bins_.begin());
+            tile_animals_.resize(tile_bins_.back());
         }
     }
-    std::random_device                  rand_dev;
-    std::mt19937                        generator(rand_dev());
-    std::uniform_int_distribution<int>  distr(min, max);
-    return distr(generator);
-}
+    // The fill pass moved each start to the start of the next tile
+    std::rotate(tile_bins_.begin(), tile_bins_.end() - 1, tile_bins_.end());
+    tile_bins_[0] = 0;
 
-animal::animal(const std::string& file_path, SDL_Surface* window_surface_ptr) {
-    image_ptr_ = IMG_Load(file_path.c_str());
-    window_surface_ptr_ = window_surface_ptr;
-    position_.x = 0;
-    position_.y = 0;
-    position_.w = image_ptr_->w;
-    position_.h = image_ptr_->h;
+    bool locked = SDL_MUSTLOCK(window_surface_ptr_);
+    if (locked && SDL_LockSurface(window_surface_ptr_) < 0)
+        throw std::runtime_error("ground::composite(): could not lock the window surface: " +
+            std::string(SDL_GetError()));
+    workers_->parallel_for(painted_tiles_.size(),
+        [this](size_t task) { composite_tile(painted_tiles_[task]); });
+    if (locked)
+        SDL_UnlockSurface(window_surface_ptr_);
+}
 
-    targetX = 0, targetY = 0;
-};
+void ground::composite_tile(Uint32 tile) {
+    SDL_Rect clip = tile_rect(int(tile % tile_columns_), int(tile / tile_columns_));
+    for (int row = clip.y; row < clip.y + clip.h; row++)
+    {
+        Uint32* pixels = reinterpret_cast<Uint32*>(
+            static_cast<Uint8*>(window_surface_ptr_->pixels) + row * window_surface_ptr_->pitch);
+        std::fill(pixels + clip.x, pixels + clip.x + clip.w, background_color_);
+    }
+    for (Uint32 k = tile_bins_[tile]; k < tile_bins_[tile + 1]; k++)
+    {
+        Uint32 i = tile_animals_[k];
+        blend_sprite(*atlas_, species_[species_of_[i]]->sprite_rect(), window_surface_ptr_,
+            drawn_x_[i], drawn_y_[i], clip);
+    }
+}
 
-animal::~animal() {
-    SDL_FreeSurface(image_ptr_);
-};
+const std::vector<SDL_Rect>& ground::dirty_rects() const {
+    return dirty_rects_;
+}
 
-void animal::draw() {
-    SDL_BlitScaled(image_ptr_, NULL, window_surface_ptr_, &position_);
-};
+void ground::invalidate(const SDL_Rect& rect) {
+    mark_dirty(rect);
+}
 
-// ---------------- sheep class impl ----------------
-sheep::sheep(SDL_Surface* window_surface_ptr) : animal("./media/sheep.png", window_surface_ptr) {
-    this->position_.x = getRandomSpawn(DIRECTION::HORIZONTAL);
-    this->position_.y = getRandomSpawn(DIRECTION::VERTICAL);
-    this->targetX = getRandomTarget(100, DIRECTION::HORIZONTAL);
-    this->targetY = getRandomTarget(100, DIRECTION::VERTICAL);
+void ground::update() {
+    move();
+    draw(1.);
 }
 
-void sheep::move() {
-    if (position_.x > targetX) {
-        position_.x--;
+void ground::save(std::ostream& out) const {
+    snapshot_header header = {};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.byte_order = snapshot_byte_order;
+    header.species_count = SPECIES_COUNT;
+    header.world_width = Uint32(world_width_);
+    header.world_height = Uint32(world_height_);
+    header.boundary = Uint32(boundary_);
+    header.retarget_radius = retarget_radius();
+    header.seed = seed_;
+    header.generator = generator_;
+    header.animal_count = x_.size();
+    header.chunk_generator_count = chunk_generators_.size();
+    header.entry_count = entry_index_.size();
+    header.free_entry_count = free_entries_.size();
+
+    size_t count = x_.size();
+    const char* columns[snapshot_column_count] = {
+        reinterpret_cast<const char*>(x_.data()), reinterpret_cast<const char*>(y_.data()),
+        reinterpret_cast<const char*>(previous_x_.data()),
+        reinterpret_cast<const char*>(previous_y_.data()),
+        reinterpret_cast<const char*>(target_x_.data()),
+        reinterpret_cast<const char*>(target_y_.data()),
+        reinterpret_cast<const char*>(species_of_.data()),
+        reinterpret_cast<const char*>(rest_.data()),
+        reinterpret_cast<const char*>(handle_entry_.data()),
+        reinterpret_cast<const char*>(chunk_generators_.data()),
+        reinterpret_cast<const char*>(entry_index_.data()),
+        reinterpret_cast<const char*>(entry_generation_.data()),
+        reinterpret_cast<const char*>(free_entries_.data()) };
+    const Uint64 column_sizes[snapshot_column_count] = {
+        count * sizeof(int), count * sizeof(int), count * sizeof(int), count * sizeof(int),
+        count * sizeof(int), count * sizeof(int), count * sizeof(Uint8),
+        count * sizeof(Uint16), count * sizeof(Uint32), chunk_generators_.size() * sizeof(random_generator),
+        entry_index_.size() * sizeof(Uint32), entry_generation_.size() * sizeof(Uint32),
+        free_entries_.size() * sizeof(Uint32) };
+    Uint64 offset = sizeof(header);
+    for (int column = 0; column < snapshot_column_count; column++)
+    {
+        offset = (offset + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+        header.offsets[column] = offset;
+        offset += column_sizes[column];
+    }
+
+    const char padding[snapshot_alignment] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    offset = sizeof(header);
+    for (int column = 0; column < snapshot_column_count; column++)
+    {
+        out.write(padding, std::streamsize(header.offsets[column] - offset));
+        out.write(columns[column], std::streamsize(column_sizes[column]));
+        offset = header.offsets[column] + column_sizes[column];
     }
-    else if (position_.x < targetX) {
-        position_.x++;
+}
+
+void ground::load(const char* data, size_t size) {
+    snapshot_header header;
+    if (size < sizeof(header))
+        throw std::runtime_error("ground::load(): snapshot too small");
+    std::memcpy(&header, data, sizeof(header));
+    if (!std::equal(header.magic, header.magic + sizeof(header.magic), snapshot_magic))
+        throw std::runtime_error("ground::load(): not a ground snapshot");
+    if (header.version != snapshot_version)
+        throw std::runtime_error("ground::load(): unsupported snapshot version " +
+            std::to_string(header.version));
+    if (header.byte_order != snapshot_byte_order || header.species_count != SPECIES_COUNT)
+        throw std::runtime_error("ground::load(): snapshot saved by an incompatible build");
+    if (header.world_width <= 2 * Uint64(header.boundary) ||
+        header.world_height <= 2 * Uint64(header.boundary) ||
+        header.world_width > max_world_size || header.world_height > max_world_size)
+        throw std::runtime_error("ground::load(): invalid world size");
+    if (header.retarget_radius <= 0)
+        throw std::runtime_error("ground::load(): invalid retarget radius");
+
+    size_t count = size_t(header.animal_count);
+    seed_ = header.seed;
+    generator_ = header.generator;
+    read_column(data, size, header.offsets[0], count, x_);
+    read_column(data, size, header.offsets[1], count, y_);
+    read_column(data, size, header.offsets[2], count, previous_x_);
+    read_column(data, size, header.offsets[3], count, previous_y_);
+    read_column(data, size, header.offsets[4], count, target_x_);
+    read_column(data, size, header.offsets[5], count, target_y_);
+    read_column(data, size, header.offsets[6], count, species_of_);
+    read_column(data, size, header.offsets[7], count, rest_);
+    read_column(data, size, header.offsets[8], count, handle_entry_);
+    read_column(data, size, header.offsets[9], size_t(header.chunk_generator_count),
+        chunk_generators_);
+    read_column(data, size, header.offsets[10], size_t(header.entry_count), entry_index_);
+    read_column(data, size, header.offsets[11], size_t(header.entry_count), entry_generation_);
+    read_column(data, size, header.offsets[12], size_t(header.free_entry_count),
+        free_entries_);
+
+    for (size_t& species_count : species_count_)
+        species_count = 0;
+    for (Uint8 species : species_of_)
+    {
+        if (species >= SPECIES_COUNT)
+            throw std::runtime_error("ground::load(): unknown species");
+        species_count_[species]++;
     }
-    if (position_.y > targetY) {
-        position_.y--;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (handle_entry_[i] >= entry_index_.size() || entry_index_[handle_entry_[i]] != i)
+            throw std::runtime_error("ground::load(): inconsistent handles");
     }
-    else if (position_.y < targetY) {
-        position_.y++;
+    for (Uint32 entry : free_entries_)
+    {
+        if (entry >= entry_index_.size() || entry_index_[entry] != no_index)
+            throw std::runtime_error("ground::load(): inconsistent handles");
     }
-    if (targetX == position_.x && targetY == position_.y)
+
+    // The snapshot brings its own world
+    configure(int(header.boundary), header.retarget_radius);
+    if (int(header.world_width) != world_width_ || int(header.world_height) != world_height_)
     {
-        this->targetX = getRandomTarget(100, DIRECTION::HORIZONTAL);
-        this->targetY = getRandomTarget(100, DIRECTION::VERTICAL);
+        world_width_ = int(header.world_width);
+        world_height_ = int(header.world_height);
+        grids_.clear();
+        for (size_t species = 0; species < SPECIES_COUNT; species++)
+            grids_.emplace_back(world_width_, world_height_, grid_cell_size);
+        set_camera(camera_x_, camera_y_, zoom_);
     }
+
+    // Nothing drawn yet for the new herd
+    drawn_x_ = x_;
+    drawn_y_ = y_;
+    vacated_rects_.clear();
+    visible_.clear();
+    full_repaint_ = true;
+    grids_dirty_ = true;
 }
 
-// ---------------- wolf class impl ----------------
+void ground::save_file(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("ground::save_file(): could not open " + path);
+    save(out);
+    if (!out.flush())
+        throw std::runtime_error("ground::save_file(): could not write " + path);
+}
+
+void ground::load_file(const std::string& path) {
+    mapped_file file(path);
+    load(file.data(), file.size());
+}
+
+// ---------------- event_pump class impl ----------------
 
-wolf::wolf(SDL_Surface* window_surface_ptr) : animal("./media/wolf.png", window_surface_ptr) {
-    this->position_.x = getRandomSpawn(DIRECTION::HORIZONTAL);
-    this->position_.y = getRandomSpawn(DIRECTION::VERTICAL);
+event_pump::event_pump() {
+    handled_count_ = 0;
+    total_latency_ = 0;
+    max_latency_ = 0;
+}
 
-    this->targetX = getRandomTarget(100, DIRECTION::HORIZONTAL);
-    this->targetY = getRandomTarget(100, DIRECTION::VERTICAL);
+void event_pump::add_handler(Uint32 type, std::function<void(const SDL_Event&)> handler) {
+    handlers_[type].push_back(std::move(handler));
 }
 
-void wolf::move() {
-    if (position_.x > targetX) {
-        position_.x--;
+size_t event_pump::pump() {
+    size_t count = 0;
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        Uint32 latency = SDL_GetTicks() - event.common.timestamp;
+        max_latency_ = std::max(max_latency_, latency);
+        total_latency_ += latency;
+        count++;
+
+        for (Uint32 type : { Uint32(event.type), Uint32(SDL_FIRSTEVENT) })
+        {
+            auto handlers = handlers_.find(type);
+            if (handlers == handlers_.end())
+                continue;
+            for (const std::function<void(const SDL_Event&)>& handler : handlers->second)
+                handler(event);
+        }
     }
-    else if (position_.x < targetX) {
-        position_.x++;
+    handled_count_ += count;
+    return count;
+}
+
+Uint64 event_pump::handled_count() const {
+    return handled_count_;
+}
+
+double event_pump::average_latency() const {
+    return handled_count_ ? double(total_latency_) / handled_count_ : 0.;
+}
+
+Uint32 event_pump::max_latency() const {
+    return max_latency_;
+}
+
+// ---------------- frame_profiler class impl ----------------
+
+namespace {
+const SDL_Color phase_colors[FRAME_PHASE_COUNT] = {
+    { 255, 255, 0, 255 },   // EVENTS
+    { 255, 0, 0, 255 },     // SIMULATE
+    { 128, 128, 128, 255 }, // CLEAR
+    { 0, 128, 255, 255 },   // DRAW
+    { 255, 0, 255, 255 },   // PRESENT
+    { 64, 64, 64, 255 }     // SLEEP
+};
+}
+
+frame_profiler::frame_profiler(int window_height, double frame_time) {
+    samples_.assign(history * FRAME_PHASE_COUNT, 0);
+    window_height_ = window_height;
+    frame_time_ = frame_time;
+    frame_count_ = 0;
+    frequency_ = double(SDL_GetPerformanceFrequency());
+    overlay_ = false;
+}
+
+void frame_profiler::begin_frame() {
+    Uint64* frame = samples_.data() + frame_count_ % history * FRAME_PHASE_COUNT;
+    std::fill(frame, frame + FRAME_PHASE_COUNT, 0);
+}
+
+void frame_profiler::add(FRAME_PHASE phase, Uint64 counter) {
+    samples_[frame_count_ % history * FRAME_PHASE_COUNT + phase] += counter;
+}
+
+void frame_profiler::end_frame() {
+    frame_count_++;
+}
+
+size_t frame_profiler::frame_count() const {
+    return std::min(frame_count_, history);
+}
+
+double frame_profiler::duration(size_t frame, FRAME_PHASE phase) const {
+    const Uint64* counters = samples_.data() + frame % history * FRAME_PHASE_COUNT;
+    Uint64 counter = phase == FRAME_PHASE_COUNT ?
+        std::accumulate(counters, counters + FRAME_PHASE_COUNT, Uint64(0)) : counters[phase];
+    return 1000. * counter / frequency_;
+}
+
+double frame_profiler::percentile(FRAME_PHASE phase, double fraction) const {
+    size_t count = frame_count();
+    if (!count)
+        return 0.;
+    std::vector<double> durations(count);
+    for (size_t i = 0; i < count; i++)
+        durations[i] = duration(frame_count_ - count + i, phase);
+    size_t rank = std::min(size_t(fraction * count), count - 1);
+    std::nth_element(durations.begin(), durations.begin() + rank, durations.end());
+    return durations[rank];
+}
+
+double frame_profiler::mean(FRAME_PHASE phase) const {
+    size_t count = frame_count();
+    double total = 0.;
+    for (size_t i = 0; i < count; i++)
+        total += duration(frame_count_ - count + i, phase);
+    return count ? total / count : 0.;
+}
+
+const char* frame_profiler::phase_name(FRAME_PHASE phase) {
+    switch (phase)
+    {
+    case FRAME_PHASE::EVENTS:
+        return "events";
+    case FRAME_PHASE::SIMULATE:
+        return "simulate";
+    case FRAME_PHASE::CLEAR:
+        return "clear";
+    case FRAME_PHASE::DRAW:
+        return "draw";
+    case FRAME_PHASE::PRESENT:
+        return "present";
+    case FRAME_PHASE::SLEEP:
+        return "sleep";
+    default:
+        return "frame";
     }
-    if (position_.y > targetY) {
-        position_.y--;
+}
+
+void frame_profiler::set_overlay(bool overlay) {
+    overlay_ = overlay;
+}
+
+bool frame_profiler::overlay() const {
+    return overlay_;
+}
+
+SDL_Rect frame_profiler::overlay_rect() const {
+    return SDL_Rect{ 0, window_height_ - profile_overlay_height,
+        profile_overlay_width, profile_overlay_height };
+}
+
+void frame_profiler::layout_overlay() {
+    SDL_Rect area = overlay_rect();
+    double pixels_per_ms = profile_overlay_height / (2000. * frame_time_);
+    size_t count = std::min(frame_count(), size_t(profile_overlay_width));
+    for (std::vector<SDL_Rect>& rects : overlay_rects_)
+        rects.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t frame = frame_count_ - count + i;
+        int column = area.x + area.w - int(count) + int(i);
+        int bottom = area.y + area.h;
+        double stacked = 0.;
+        for (int phase = 0; phase < FRAME_PHASE_COUNT && bottom > area.y; phase++)
+        {
+            stacked += duration(frame, FRAME_PHASE(phase)) * pixels_per_ms;
+            int top = std::max(area.y + area.h - int(stacked + 0.5), area.y);
+            if (top < bottom)
+                overlay_rects_[phase].push_back(SDL_Rect{ column, top, 1, bottom - top });
+            bottom = std::min(bottom, top);
+        }
     }
-    else if (position_.y < targetY) {
-        position_.y++;
+}
+
+void frame_profiler::draw_overlay(SDL_Surface* surface) {
+    layout_overlay();
+    SDL_Rect area = overlay_rect();
+    SDL_FillRect(surface, &area, SDL_MapRGB(surface->format, 0, 0, 0));
+    for (int phase = 0; phase < FRAME_PHASE_COUNT; phase++)
+    {
+        const SDL_Color& color = phase_colors[phase];
+        SDL_FillRects(surface, overlay_rects_[phase].data(), int(overlay_rects_[phase].size()),
+            SDL_MapRGB(surface->format, color.r, color.g, color.b));
     }
-    if (targetX == position_.x && targetY == position_.y)
+    SDL_Rect budget = { area.x, area.y + area.h / 2, area.w, 1 };
+    SDL_FillRect(surface, &budget, SDL_MapRGB(surface->format, 255, 255, 255));
+}
+
+void frame_profiler::draw_overlay(SDL_Renderer* renderer) {
+    layout_overlay();
+    SDL_Rect area = overlay_rect();
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(renderer, &area);
+    for (int phase = 0; phase < FRAME_PHASE_COUNT; phase++)
     {
-        this->targetX = getRandomTarget(100, DIRECTION::HORIZONTAL);
-        this->targetY = getRandomTarget(100, DIRECTION::VERTICAL);
+        const SDL_Color& color = phase_colors[phase];
+        SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, 255);
+        SDL_RenderFillRects(renderer, overlay_rects_[phase].data(),
+            int(overlay_rects_[phase].size()));
     }
+    SDL_Rect budget = { area.x, area.y + area.h / 2, area.w, 1 };
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderFillRect(renderer, &budget);
 }
 
-// ---------------- ground class impl ----------------
+void frame_profiler::report(std::ostream& out) const {
+    out << "Frame times over the last " << frame_count() << " frames (ms):" << std::endl;
+    for (int phase = 0; phase <= FRAME_PHASE_COUNT; phase++)
+        out << "  " << phase_name(FRAME_PHASE(phase))
+            << ": mean " << mean(FRAME_PHASE(phase))
+            << ", p50 " << percentile(FRAME_PHASE(phase), 0.5)
+            << ", p99 " << percentile(FRAME_PHASE(phase), 0.99)
+            << ", max " << percentile(FRAME_PHASE(phase), 1.) << std::endl;
+}
 
-ground::ground(SDL_Surface* window_surface_ptr) {
-    window_surface_ptr_ = window_surface_ptr;
-    animals_ = std::vector<std::shared_ptr<animal>>();
+void frame_profiler::write_csv(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("write_csv(): could not open " + path);
+    out << "phase,frames,mean_ms,p50_ms,p99_ms,max_ms\n";
+    for (int phase = 0; phase <= FRAME_PHASE_COUNT; phase++)
+        out << phase_name(FRAME_PHASE(phase)) << ',' << frame_count()
+            << ',' << mean(FRAME_PHASE(phase))
+            << ',' << percentile(FRAME_PHASE(phase), 0.5)
+            << ',' << percentile(FRAME_PHASE(phase), 0.99)
+            << ',' << percentile(FRAME_PHASE(phase), 1.) << '\n';
 }
 
-ground::~ground() {
-};
+// ---------------- scoped_timer class impl ----------------
 
-void ground::add_animal(std::shared_ptr<animal> newAnimal) {
-    animals_.push_back(newAnimal);
+scoped_timer::scoped_timer(frame_profiler& profiler, FRAME_PHASE phase)
+    : profiler_(profiler), phase_(phase), start_(SDL_GetPerformanceCounter()) {
 }
 
-void ground::update() {
-    for (std::shared_ptr<animal> ani : animals_)
-    {
-        ani->move();
-        ani->draw();
+scoped_timer::~scoped_timer() {
+    profiler_.add(phase_, SDL_GetPerformanceCounter() - start_);
+}
+
+// ---------------- replay_writer class impl ----------------
+
+namespace {
+const char replay_magic[4] = { 'H', 'R', 'D', 'R' };
+constexpr Uint32 replay_version = 4;
+}
+
+replay_writer::replay_writer(const std::string& path, Uint64 seed, Uint32 n_sheep,
+    Uint32 n_wolf, const ground& state)
+    : out_(path, std::ios::binary) {
+    if (!out_)
+        throw std::runtime_error("replay_writer(): could not open " + path);
+    out_.write(replay_magic, sizeof(replay_magic));
+    write_value(out_, replay_version);
+    write_value(out_, seed);
+    write_value(out_, n_sheep);
+    write_value(out_, n_wolf);
+    write_value(out_, Uint32(state.world_width()));
+    write_value(out_, Uint32(state.world_height()));
+    write_value(out_, Uint32(state.boundary()));
+    write_value(out_, Sint32(state.retarget_radius()));
+}
+
+replay_writer::~replay_writer() {
+}
+
+void replay_writer::write_event(Uint32 tick, const SDL_Event& event) {
+    Uint32 detail = 0;
+    if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP)
+        detail = Uint32(event.key.keysym.sym);
+    else if (event.type == SDL_WINDOWEVENT)
+        detail = event.window.event;
+    write_value(out_, REPLAY_RECORD::EVENT);
+    write_value(out_, tick);
+    write_value(out_, event.type);
+    write_value(out_, detail);
+}
+
+void replay_writer::write_snapshot(Uint32 tick, const ground& state) {
+    std::ostringstream data;
+    state.save(data);
+    const std::string& bytes = data.str();
+    write_value(out_, REPLAY_RECORD::SNAPSHOT);
+    write_value(out_, tick);
+    write_value(out_, Uint64(bytes.size()));
+    out_.write(bytes.data(), std::streamsize(bytes.size()));
+}
+
+void replay_writer::write_end(Uint32 tick, const ground& state) {
+    if (tick % replay_snapshot_interval)
+        write_snapshot(tick, state);
+    write_value(out_, REPLAY_RECORD::END);
+    write_value(out_, tick);
+    out_.flush();
+}
+
+// ---------------- replay_reader class impl ----------------
+
+replay_reader::replay_reader(const std::string& path)
+    : in_(path, std::ios::binary) {
+    if (!in_)
+        throw std::runtime_error("replay_reader(): could not open " + path);
+    char magic[sizeof(replay_magic)];
+    if (!in_.read(magic, sizeof(magic)) ||
+        !std::equal(magic, magic + sizeof(magic), replay_magic))
+        throw std::runtime_error("replay_reader(): " + path + " is not a replay");
+    if (read_value<Uint32>(in_) != replay_version)
+        throw std::runtime_error("replay_reader(): unsupported version of " + path);
+    seed_ = read_value<Uint64>(in_);
+    n_sheep_ = read_value<Uint32>(in_);
+    n_wolf_ = read_value<Uint32>(in_);
+    world_width_ = read_value<Uint32>(in_);
+    world_height_ = read_value<Uint32>(in_);
+    boundary_ = read_value<Uint32>(in_);
+    retarget_radius_ = read_value<Sint32>(in_);
+
+    // Index the records. A run cut short has no END record, and the last
+    // record written may itself be cut: indexing stops at the last complete
+    // record.
+    std::streamoff records_begin = in_.tellg();
+    in_.seekg(0, std::ios::end);
+    std::streamoff file_size = in_.tellg();
+    in_.seekg(records_begin);
+    auto fits = [&](Uint64 size) { return Uint64(file_size - in_.tellg()) >= size; };
+    tick_count_ = 0;
+    complete_ = false;
+    bool truncated = false;
+    while (!complete_ && !truncated && fits(sizeof(REPLAY_RECORD) + sizeof(Uint32))) {
+        REPLAY_RECORD kind = read_value<REPLAY_RECORD>(in_);
+        Uint32 tick = read_value<Uint32>(in_);
+        switch (kind)
+        {
+        case REPLAY_RECORD::EVENT:
+        {
+            truncated = !fits(2 * sizeof(Uint32));
+            if (truncated)
+                break;
+            Uint32 type = read_value<Uint32>(in_);
+            Uint32 detail = read_value<Uint32>(in_);
+            events_.push_back(replay_event{ tick, type, detail });
+            break;
+        }
+        case REPLAY_RECORD::SNAPSHOT:
+        {
+            truncated = !fits(sizeof(Uint64));
+            if (truncated)
+                break;
+            Uint64 size = read_value<Uint64>(in_);
+            truncated = !fits(size);
+            if (truncated)
+                break;
+            snapshots_.push_back(replay_snapshot{ tick, std::streamoff(in_.tellg()), size });
+            in_.seekg(std::streamoff(size), std::ios::cur);
+            break;
+        }
+        case REPLAY_RECORD::END:
+            complete_ = true;
+            break;
+        default:
+            throw std::runtime_error("replay_reader(): corrupted record in " + path);
+        }
+        if (!truncated)
+            tick_count_ = std::max(tick_count_, tick);
     }
+    in_.clear();
+}
+
+Uint64 replay_reader::seed() const {
+    return seed_;
+}
+
+Uint32 replay_reader::sheep_count() const {
+    return n_sheep_;
+}
+
+Uint32 replay_reader::wolf_count() const {
+    return n_wolf_;
+}
+
+Uint32 replay_reader::world_width() const {
+    return world_width_;
+}
+
+Uint32 replay_reader::world_height() const {
+    return world_height_;
+}
+
+Uint32 replay_reader::boundary() const {
+    return boundary_;
+}
+
+int replay_reader::retarget_radius() const {
+    return retarget_radius_;
+}
+
+Uint32 replay_reader::tick_count() const {
+    return tick_count_;
+}
+
+bool replay_reader::complete() const {
+    return complete_;
+}
+
+const std::vector<replay_event>& replay_reader::events() const {
+    return events_;
+}
+
+const std::vector<replay_snapshot>& replay_reader::snapshots() const {
+    return snapshots_;
+}
+
+const replay_snapshot* replay_reader::snapshot_before(Uint32 tick) const {
+    auto after = std::upper_bound(snapshots_.begin(), snapshots_.end(), tick,
+        [](Uint32 tick, const replay_snapshot& snapshot) { return tick < snapshot.tick; });
+    return after == snapshots_.begin() ? NULL : &*(after - 1);
+}
+
+std::string replay_reader::snapshot_data(const replay_snapshot& snapshot) const {
+    std::string data(size_t(snapshot.size), '\0');
+    in_.seekg(snapshot.offset);
+    if (!in_.read(&data[0], std::streamsize(data.size())))
+        throw std::runtime_error("replay_reader(): truncated snapshot at step " +
+            std::to_string(snapshot.tick));
+    return data;
 }
 
 // ---------------- application class impl ----------------
 
-application::application(unsigned n_sheep, unsigned n_wolf) {
+application::application(unsigned n_sheep, unsigned n_wolf, Uint64 seed, bool headless,
+    unsigned thread_count, RENDER_BACKEND backend, const run_config& config)
+    : config_(config), profiler_(int(config.frame_height), config.frame_time()) {
+    window_ptr_ = NULL;
+    window_surface_ptr_ = NULL;
+    renderer_ptr_ = NULL;
+    full_repaint_ = false;
+    running_ = true;
+    tick_count_ = 0;
+
+    events_.add_handler(SDL_QUIT, [this](const SDL_Event&) { running_ = false; });
+    events_.add_handler(SDL_WINDOWEVENT, [this](const SDL_Event& event) {
+        if (event.window.event == SDL_WINDOWEVENT_CLOSE)
+            running_ = false;
+    });
+    events_.add_handler(SDL_KEYDOWN, [this](const SDL_Event& event) {
+        switch (event.key.keysym.sym)
+        {
+        case SDLK_F1:
+            if (!event.key.repeat)
+                profiler_.set_overlay(!profiler_.overlay());
+            break;
+        case SDLK_LEFT:
+            ground_->pan(-camera_pan_step, 0);
+            break;
+        case SDLK_RIGHT:
+            ground_->pan(camera_pan_step, 0);
+            break;
+        case SDLK_UP:
+            ground_->pan(0, -camera_pan_step);
+            break;
+        case SDLK_DOWN:
+            ground_->pan(0, camera_pan_step);
+            break;
+        case SDLK_PLUS:
+        case SDLK_EQUALS:
+        case SDLK_KP_PLUS:
+            ground_->zoom_at(camera_zoom_step, config_.frame_width / 2,
+                config_.frame_height / 2);
+            break;
+        case SDLK_MINUS:
+        case SDLK_KP_MINUS:
+            ground_->zoom_at(1 / camera_zoom_step, config_.frame_width / 2,
+                config_.frame_height / 2);
+            break;
+        }
+    });
+    events_.add_handler(SDL_MOUSEWHEEL, [this](const SDL_Event& event) {
+        int x, y;
+        SDL_GetMouseState(&x, &y);
+        ground_->zoom_at(std::pow(camera_zoom_step, event.wheel.y), x, y);
+    });
+    events_.add_handler(SDL_MOUSEMOTION, [this](const SDL_Event& event) {
+        if (event.motion.state & SDL_BUTTON_LMASK)
+            ground_->pan(-event.motion.xrel, -event.motion.yrel);
+    });
+
     // Create an application window with the following settings:
-    window_ptr_ = SDL_CreateWindow(
-        "An SDL2 window",                  // window title
-        SDL_WINDOWPOS_UNDEFINED,           // initial x position
-        SDL_WINDOWPOS_UNDEFINED,           // initial y position
-        frame_width,                               // width, in pixels
-        frame_height,                               // height, in pixels
-        SDL_WINDOW_SHOWN // flags - see below
-    );
+    if (!headless)
+    {
+        window_ptr_ = SDL_CreateWindow(
+            "An SDL2 window",                  // window title
+            SDL_WINDOWPOS_UNDEFINED,           // initial x position
+            SDL_WINDOWPOS_UNDEFINED,           // initial y position
+            config_.frame_width,                       // width, in pixels
+            config_.frame_height,                      // height, in pixels
+            SDL_WINDOW_SHOWN // flags - see below
+        );
+        // The size comes from the configuration, SDL may well reject it
+        if (!window_ptr_)
+            throw std::runtime_error("application(): could not create window: " +
+                std::string(SDL_GetError()));
 
-    window_surface_ptr_ = SDL_GetWindowSurface(window_ptr_);
+        if (backend == RENDER_BACKEND::SURFACE)
+        {
+            window_surface_ptr_ = SDL_GetWindowSurface(window_ptr_);
+            if (!window_surface_ptr_)
+                throw std::runtime_error("application(): could not get window surface: " +
+                    std::string(SDL_GetError()));
+        }
+        else
+        {
+#ifdef SDL_HINT_RENDER_BATCHING
+            SDL_SetHint(SDL_HINT_RENDER_BATCHING, "1");
+#endif
+            Uint32 flags = backend == RENDER_BACKEND::SOFTWARE_RENDERER ?
+                SDL_RENDERER_SOFTWARE : SDL_RENDERER_ACCELERATED;
+            renderer_ptr_ = SDL_CreateRenderer(window_ptr_, -1, flags);
+            if (!renderer_ptr_)
+                throw std::runtime_error("application(): could not create renderer: " +
+                    std::string(SDL_GetError()));
+        }
+    }
 
-    ground_ = std::make_unique<ground>(window_surface_ptr_);
+    ground_ = std::make_unique<ground>(window_surface_ptr_, renderer_ptr_, seed,
+        thread_count, config_);
 
+    ground_->reserve(n_sheep + n_wolf);
     for (size_t i = 0; i < n_sheep; i++)
-        ground_->add_animal(std::make_shared<sheep>(window_surface_ptr_));
+        ground_->add_animal(SPECIES::SHEEP);
 
     for (size_t i = 0; i < n_wolf; i++)
-        ground_->add_animal(std::make_shared<wolf>(window_surface_ptr_));
+        ground_->add_animal(SPECIES::WOLF);
 }
 
 application::~application() {
+    // The textures of the animals belong to the renderer
+    ground_.reset();
+    if (renderer_ptr_)
+        SDL_DestroyRenderer(renderer_ptr_);
+
     // Close and destroy the window
-    SDL_DestroyWindow(window_ptr_);
+    if (window_ptr_)
+        SDL_DestroyWindow(window_ptr_);
+}
+
+void application::set_full_repaint(bool full_repaint) {
+    full_repaint_ = full_repaint;
+}
+
+void application::set_lod_coverage(double coverage) {
+    ground_->set_lod_coverage(coverage);
+}
+
+void application::set_profile_overlay(bool overlay) {
+    profiler_.set_overlay(overlay);
+}
+
+void application::set_profile_output(const std::string& path) {
+    profile_path_ = path;
+}
+
+void application::record(const std::string& path, Uint64 seed, unsigned n_sheep,
+    unsigned n_wolf) {
+    recorder_ = std::make_unique<replay_writer>(path, seed, n_sheep, n_wolf, *ground_);
+    recorder_->write_snapshot(tick_count_, *ground_);
+    events_.add_handler(SDL_FIRSTEVENT, [this](const SDL_Event& event) {
+        if (recorder_)
+            recorder_->write_event(tick_count_, event);
+    });
+}
+
+void application::load_snapshot(const std::string& path) {
+    ground_->load_file(path);
+}
+
+void application::set_snapshot_output(const std::string& path) {
+    snapshot_path_ = path;
+}
+
+void application::step() {
+    ground_->move();
+    tick_count_++;
+    if (recorder_ && tick_count_ % replay_snapshot_interval == 0)
+        recorder_->write_snapshot(tick_count_, *ground_);
 }
 
 int application::loop(unsigned period) {
-    SDL_Rect windowsRect = SDL_Rect{ 0,0,frame_width, frame_height };
+    SDL_Rect windowsRect = SDL_Rect{ 0,0,int(config_.frame_width), int(config_.frame_height) };
+    double frequency = double(SDL_GetPerformanceFrequency());
+    Uint64 busy_counter = 0;
+    unsigned frame_count = 0;
+    Uint32 first_tick = tick_count_;
+    double accumulator = 0.;
+    Uint64 previous_counter = SDL_GetPerformanceCounter();
+    bool overlay_drawn = false;
     while (period * 1000 >= SDL_GetTicks()) {
-        SDL_FillRect(window_surface_ptr_, &windowsRect, SDL_MapRGB(window_surface_ptr_->format, 0, 255, 0));
-        SDL_PollEvent(&window_event_);
-        if (window_event_.type == SDL_QUIT || window_event_.type == SDL_WINDOWEVENT &&
-            window_event_.window.event == SDL_WINDOWEVENT_CLOSE)
+        Uint64 frame_start = SDL_GetPerformanceCounter();
+        accumulator += std::min((frame_start - previous_counter) / frequency,
+            max_catch_up_time);
+        previous_counter = frame_start;
+
+        profiler_.begin_frame();
+        {
+            scoped_timer timer(profiler_, FRAME_PHASE::EVENTS);
+            events_.pump();
+        }
+        if (!running_)
             break;
-        ground_->update();
-        SDL_UpdateWindowSurface(window_ptr_);
-        SDL_Delay(frame_time * 1000);  // Pause execution for framerate milliseconds
+
+        // Run as many simulation steps as the elapsed time calls for
+        {
+            scoped_timer timer(profiler_, FRAME_PHASE::SIMULATE);
+            while (accumulator >= tick_time) {
+                step();
+                accumulator -= tick_time;
+            }
+        }
+
+        if (renderer_ptr_)
+        {
+            {
+                scoped_timer timer(profiler_, FRAME_PHASE::CLEAR);
+                SDL_SetRenderDrawColor(renderer_ptr_, 0, 255, 0, 255);
+                SDL_RenderClear(renderer_ptr_);
+            }
+            {
+                scoped_timer timer(profiler_, FRAME_PHASE::DRAW);
+                ground_->draw(accumulator / tick_time);
+                if (profiler_.overlay())
+                    profiler_.draw_overlay(renderer_ptr_);
+            }
+            scoped_timer timer(profiler_, FRAME_PHASE::PRESENT);
+            SDL_RenderPresent(renderer_ptr_);
+        }
+        else if (full_repaint_)
+        {
+            {
+                scoped_timer timer(profiler_, FRAME_PHASE::CLEAR);
+                SDL_FillRect(window_surface_ptr_, &windowsRect, SDL_MapRGB(window_surface_ptr_->format, 0, 255, 0));
+            }
+            {
+                scoped_timer timer(profiler_, FRAME_PHASE::DRAW);
+                ground_->draw(accumulator / tick_time);
+                if (profiler_.overlay())
+                    profiler_.draw_overlay(window_surface_ptr_);
+            }
+            scoped_timer timer(profiler_, FRAME_PHASE::PRESENT);
+            SDL_UpdateWindowSurface(window_ptr_);
+        }
+        else
+        {
+            bool dirty_only;
+            {
+                // The overlay, and where it was, are repainted at each frame
+                scoped_timer timer(profiler_, FRAME_PHASE::DRAW);
+                if (overlay_drawn)
+                    ground_->invalidate(profiler_.overlay_rect());
+                dirty_only = ground_->draw_dirty(accumulator / tick_time);
+                overlay_drawn = profiler_.overlay();
+                if (overlay_drawn)
+                    profiler_.draw_overlay(window_surface_ptr_);
+            }
+            scoped_timer timer(profiler_, FRAME_PHASE::PRESENT);
+            const std::vector<SDL_Rect>& rects = ground_->dirty_rects();
+            if (!dirty_only)
+                SDL_UpdateWindowSurface(window_ptr_);
+            else if (!rects.empty())
+                SDL_UpdateWindowSurfaceRects(window_ptr_, rects.data(), int(rects.size()));
+        }
+
+        Uint64 frame_counter = SDL_GetPerformanceCounter() - frame_start;
+        busy_counter += frame_counter;
+        frame_count++;
+
+        // Only sleep for what is left of the frame
+        double remaining = config_.frame_time() - frame_counter / frequency;
+        if (remaining > 0.)
+        {
+            scoped_timer timer(profiler_, FRAME_PHASE::SLEEP);
+            SDL_Delay(Uint32(remaining * 1000));
+        }
+        profiler_.end_frame();
     }
+    if (frame_count)
+        std::cout << "Average frame time (without delay): "
+            << 1000. * busy_counter / frequency / frame_count
+            << " ms over " << frame_count << " frames, "
+            << tick_count_ - first_tick << " simulation steps" << std::endl;
+    std::cout << "Handled " << events_.handled_count() << " events, waiting "
+        << events_.average_latency() << " ms on average and at most "
+        << events_.max_latency() << " ms in the queue" << std::endl;
+    profiler_.report(std::cout);
+    if (!profile_path_.empty())
+        profiler_.write_csv(profile_path_);
+    if (recorder_)
+        recorder_->write_end(tick_count_, *ground_);
+    if (!snapshot_path_.empty())
+        ground_->save_file(snapshot_path_);
     return 1;
 }
-namespace {
-    // Defining a namespace without a name -> Anonymous workspace
-    // Its purpose is to indicate to the compiler that everything
-    // inside of it is UNIQUELY used within this source file.
 
-    SDL_Surface* load_surface_for(const std::string& path,
-        SDL_Surface* window_surface_ptr) {
+int application::run_headless(unsigned period) {
+    unsigned tick_count = unsigned(period * tick_rate);
+    size_t animal_count = ground_->size();
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (unsigned tick = 0; tick < tick_count; tick++)
+        step();
+    double elapsed = double(SDL_GetPerformanceCounter() - start) /
+        SDL_GetPerformanceFrequency();
 
-        // Helper function to load a png for a specific surface
-        // See SDL_ConvertSurface
-        return NULL;
+    std::cout << "Simulated " << tick_count << " steps of " << animal_count
+        << " animals on " << ground_->thread_count() << " threads in " << elapsed
+        << " s: " << tick_count / elapsed
+        << " ticks/s, " << ground_->count(SPECIES::SHEEP) << " sheep and "
+        << ground_->count(SPECIES::WOLF) << " wolves left" << std::endl;
+    if (recorder_)
+        recorder_->write_end(tick_count_, *ground_);
+    if (!snapshot_path_.empty())
+        ground_->save_file(snapshot_path_);
+    return 1;
+}
+
+int application::run_replay(const replay_reader& replay, Uint32 seek) {
+    seek = std::min(seek, replay.tick_count());
+    double frequency = double(SDL_GetPerformanceFrequency());
+    Uint64 start = SDL_GetPerformanceCounter();
+    const replay_snapshot* snapshot = replay.snapshot_before(seek);
+    if (snapshot)
+    {
+        std::string data = replay.snapshot_data(*snapshot);
+        ground_->load(data.data(), data.size());
+        tick_count_ = snapshot->tick;
     }
-} // namespace
+    while (tick_count_ < seek)
+        step();
+    std::cout << "Reached step " << seek << " in "
+        << 1000. * (SDL_GetPerformanceCounter() - start) / frequency << " ms, from step "
+        << (snapshot ? snapshot->tick : 0) << ": " << ground_->count(SPECIES::SHEEP)
+        << " sheep and " << ground_->count(SPECIES::WOLF) << " wolves" << std::endl;
+
+    // Play the rest, comparing the ground to each snapshot on the way
+    start = SDL_GetPerformanceCounter();
+    Uint32 first_tick = tick_count_;
+    size_t checked = 0;
+    long diverged = -1;
+    const std::vector<replay_snapshot>& snapshots = replay.snapshots();
+    auto next = std::upper_bound(snapshots.begin(), snapshots.end(), tick_count_,
+        [](Uint32 tick, const replay_snapshot& snapshot) { return tick < snapshot.tick; });
+    while (tick_count_ < replay.tick_count()) {
+        step();
+        if (next == snapshots.end() || next->tick != tick_count_)
+            continue;
+        std::ostringstream data;
+        ground_->save(data);
+        if (diverged < 0 && data.str() != replay.snapshot_data(*next))
+            diverged = tick_count_;
+        checked++;
+        ++next;
+    }
+    double elapsed = double(SDL_GetPerformanceCounter() - start) / frequency;
+
+    Uint32 played = tick_count_ - first_tick;
+    std::cout << "Played steps " << first_tick << " to " << tick_count_ << " in " << elapsed
+        << " s: " << played / elapsed << " ticks/s, " << played / tick_rate / elapsed
+        << " times real time, " << ground_->count(SPECIES::SHEEP) << " sheep and "
+        << ground_->count(SPECIES::WOLF) << " wolves left" << std::endl;
+    if (diverged >= 0)
+        std::cout << "Diverged from the recording at step " << diverged << std::endl;
+    else
+        std::cout << "Matched the " << checked << " snapshots of the recording" << std::endl;
+    if (!replay.complete())
+        std::cout << "The recording was cut short" << std::endl;
+    return diverged >= 0 ? 2 : 1;
+}
@@ -5,116 +5,826 @@
 
 #include <SDL.h>
 #include <SDL_image.h>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <random>
+#include <string>
 
-// Defintions
+// Defintions, the frame and retarget constants being the defaults of
+// run_config
 constexpr double frame_rate = 60.0; // refresh rate
 constexpr double frame_time = 1. / frame_rate;
+constexpr double tick_rate = 120.0; // simulation steps per second
+constexpr double tick_time = 1. / tick_rate;
+// Largest side of the cells of the spatial grid, about the size of a sprite.
+// Dense herds get smaller cells, holding about grid_animals_per_cell animals.
+// Sparse herds in a large world get larger cells instead, so that the grid
+// never has more than grid_cells_per_animal cells for each animal.
+constexpr int grid_cell_size = 64;
+constexpr int grid_animals_per_cell = 2;
+constexpr int grid_cells_per_animal = 16;
+// Largest side of the world, small enough for a position plus a distance
+// across the world to fit in an int
+constexpr unsigned max_world_size = 1u << 29;
+// Side of the tiles in which the window is split to track what changed
+// between two frames, and fraction of changed tiles above which the whole
+// frame is repainted instead
+constexpr int dirty_tile_size = 32;
+constexpr double dirty_repaint_threshold = 0.5;
+// Default number of sprites covering each window pixel, on average, above
+// which the animals are drawn as single pixels of their species' color
+constexpr double lod_coverage = 32;
+// Distance under which a wolf eats the sheep it is chasing, and steps it
+// then rests before hunting again, so that the sheep are not all gone
+// within a few seconds
+constexpr int eat_distance = 10;
+constexpr Uint16 hunt_cooldown = Uint16(10 * tick_rate);
+// Longest time the simulation catches up on after a slow frame, so that
+// one hiccup does not trigger an endless series of catch-up steps
+constexpr double max_catch_up_time = 0.25;
+// Size of the frame time overlay, which shows one frame per column and
+// two frame_time over its height
+constexpr int profile_overlay_width = 256;
+constexpr int profile_overlay_height = 64;
+// Steps between two snapshots of the ground in a replay
+constexpr unsigned replay_snapshot_interval = 10 * tick_rate;
 constexpr unsigned frame_width = 1400/2; // Width of window in pixel
 constexpr unsigned frame_height = 900/2; // Height of window in pixel
 // Minimal distance of animals to the border
-// of the screen
+// of the world
 constexpr unsigned frame_boundary = 100;
+// How far away from its position an animal picks its next target
+constexpr int default_retarget_radius = 100;
+// Limits of the camera zoom, in window pixels per world pixel, and how far
+// the camera moves for each press of an arrow key, in window pixels, and
+// zooms for each notch of the mouse wheel
+constexpr double min_zoom = 1. / 64;
+constexpr double max_zoom = 8;
+constexpr int camera_pan_step = 32;
+constexpr double camera_zoom_step = 1.25;
 
-// Helper function to initialize SDL
-void init();
+// Parameters of a run which may be changed without rebuilding, read from
+// the command line or from a file of "name = value" lines, where # starts
+// a comment. The world is the size of the window unless given.
+struct run_config {
+	double frame_rate = ::frame_rate;
+	unsigned frame_width = ::frame_width;
+	unsigned frame_height = ::frame_height;
+	unsigned frame_boundary = ::frame_boundary;
+	int retarget_radius = default_retarget_radius;
+	unsigned world_width = 0; // 0 for frame_width
+	unsigned world_height = 0; // 0 for frame_height
 
-enum DIRECTION
+	double frame_time() const;
+	// Throws on an unknown name or a value out of range
+	void set(const std::string& name, const std::string& value);
+	void load(const std::string& path);
+};
+
+// Helper function to initialize SDL, a headless run needs neither
+// video nor PNG loading
+void init(bool headless);
+
+// Instruction sets the movement step and sprite blending have kernels for,
+// every kernel giving the same result
+enum SIMD_LEVEL
+{
+	SCALAR,
+	SSE2,
+	AVX2
+};
+
+// How frames are drawn: blitting onto the window surface on the CPU, or
+// through an SDL_Renderer with one texture holding every species
+enum RENDER_BACKEND
+{
+	SURFACE,
+	ACCELERATED_RENDERER,
+	SOFTWARE_RENDERER
+};
+
+// Widest instruction set supported by the CPU we are running on
+SIMD_LEVEL fastest_simd_level();
+
+// Blend count sprite pixels, premultiplied by their alpha which is in the
+// top byte, onto count window pixels with the same color layout. Each
+// byte of the target becomes s + d * (255 - alpha) / 255, rounded to the
+// nearest, the same for every kernel.
+void blend_row(Uint32* target, const Uint32* sprite, int count, SIMD_LEVEL kernel);
+
+// Small and fast pseudo random generator (PCG32). A generator is fully
+// determined by its seed and stream: generators sharing a seed but not
+// a stream produce independent sequences.
+class random_generator {
+private:
+	Uint64 state_;
+	Uint64 increment_;
+public:
+	random_generator(Uint64 seed = 0, Uint64 stream = 0);
+
+	Uint32 next();
+	// Integer in [min, max]
+	int between(int min, int max);
+};
+
+// Fixed set of threads running the iterations of a loop in parallel. The
+// calling thread takes part in the work, so a pool of one thread runs
+// everything inline. Iterations are handed out one at a time, threads
+// finishing early simply take the next one.
+class worker_pool {
+private:
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable wake_, done_;
+
+	const std::function<void(size_t)>* task_;
+	size_t task_count_;
+	std::atomic<size_t> next_task_;
+	size_t busy_workers_;
+	Uint64 generation_; // Incremented for each parallel_for call
+	bool stopping_;
+
+	void work();
+	void run_tasks();
+public:
+	worker_pool(unsigned thread_count);
+	~worker_pool();
+
+	unsigned thread_count() const;
+
+	// Call task(i) for each i in [0, task_count) and wait for all of them
+	void parallel_for(size_t task_count, const std::function<void(size_t)>& task);
+};
+
+// Every sprite packed into one surface, in the window format (see
+// load_surface_for), and into one texture when drawing through a renderer.
+// Drawing the whole herd then never switches source surface or texture,
+// however many species there are. Sprites are packed on shelves, tallest
+// first, with a pixel of transparent padding around each one so that
+// filtering never picks up a neighbour.
+class sprite_atlas {
+private:
+	SDL_Surface* surface_; // OWNING
+	SDL_Texture* texture_; // OWNING, NULL without renderer
+	std::map<std::string, SDL_Rect> rects_; // Of each sprite, by file path
+	std::vector<Uint32> premultiplied_; // See premultiplied
+public:
+	sprite_atlas(const std::vector<std::string>& file_paths,
+		SDL_Surface* window_surface_ptr, SDL_Renderer* renderer_ptr);
+	~sprite_atlas();
+	sprite_atlas(const sprite_atlas&) = delete;
+	sprite_atlas& operator=(const sprite_atlas&) = delete;
+
+	SDL_Surface* surface() const;
+	SDL_Texture* texture() const;
+	const SDL_Rect& rect(const std::string& file_path) const;
+	// Pixels of the surface with their colors premultiplied by their alpha,
+	// surface()->w per row, for blend_row. NULL unless the atlas is drawn
+	// on a window surface and has its alpha in the top byte.
+	const Uint32* premultiplied() const;
+};
+
+// Species of an animal of the herd, also the index of its description
+// in ground
+enum SPECIES : Uint8
 {
-	HORIZONTAL,
-	VERTICAL
+	SHEEP,
+	WOLF,
+	SPECIES_COUNT
 };
 
+// An animal is the description of a species: what it looks like and how it
+// picks its targets. The individual animals live in ground's arrays.
+// Its sprite is in the atlas, which is drawn either on the window surface
+// or through the renderer. There is no atlas in a headless run.
 class animal {
 private:
 	SDL_Surface* window_surface_ptr_; // ptr to the surface on which we want the
 									  // animal to be drawn, also non-owning
-	SDL_Surface* image_ptr_; // The texture of the sheep (the loaded image), use
-							 // load_surface_for
+	const sprite_atlas* atlas_; // Non-owning, NULL when headless
+	SDL_Rect sprite_rect_; // Where the sprite is in the atlas
+	bool blend_; // Drawn with blend_row rather than SDL_BlitSurface
+	SDL_Color impostor_color_; // Average color of the sprite
 protected:
-	SDL_Rect position_;
-	int targetX, targetY;
-	int getRandomSpawn(DIRECTION dir);
-	int getRandomTarget(int bounding, DIRECTION dir);
+	int retarget_radius_; // How far away from its position an animal of this
+						  // species picks its next target
+	int sight_radius_; // How far away it notices its prey or predator
+	SPECIES prey_; // Species chased by this one, SPECIES_COUNT if none
+	SPECIES predator_; // Species this one runs away from, SPECIES_COUNT if none
 public:
-	animal(const std::string& file_path, SDL_Surface* window_surface_ptr);
-	~animal();
+	animal(const std::string& file_path, const sprite_atlas* atlas,
+		SDL_Surface* window_surface_ptr);
+	virtual ~animal();
+
+	// world_size is the width or the height of the world, for a coordinate
+	// along that axis, which animals keep boundary pixels away from
+	static int getRandomSpawn(random_generator& generator, int world_size,
+		int boundary = frame_boundary);
+	static int getRandomTarget(random_generator& generator, int position,
+		int bounding, int world_size, int boundary = frame_boundary);
 
-	void draw();
+	int width() const;
+	int height() const;
+	int retarget_radius() const;
+	void set_retarget_radius(int radius);
+	int sight_radius() const;
+	SPECIES prey() const;
+	SPECIES predator() const;
 
-	virtual void move() =0;
-	// todo: Animals move around, but in a different
-							   // fashion depending on which type of animal
+	// Draw an animal of this species at the given position on the window
+	// surface
+	void draw(int x, int y) const;
+	// Same, stretched to fill destination
+	void draw(const SDL_Rect& destination) const;
+	const SDL_Rect& sprite_rect() const;
+	// Color of the single pixel standing for the animal in dense herds
+	const SDL_Color& impostor_color() const;
+
+	virtual SPECIES species() const = 0;
 };
 
 // Insert here:
 // class sheep, derived from animal
 class sheep : public animal {
 public:
-	sheep(SDL_Surface* window_surface_ptr);
+	static const char* const sprite_path;
+
+	sheep(const sprite_atlas* atlas, SDL_Surface* window_surface_ptr);
 	~sheep() {}
-	void move();
-	// implement functions that are purely virtual in base class
+	SPECIES species() const;
 };
 
 // Insert here:
 // class wolf, derived from animal
 class wolf : public animal {
 public:
-	wolf(SDL_Surface* window_surface_ptr);
+	static const char* const sprite_path;
+
+	wolf(const sprite_atlas* atlas, SDL_Surface* window_surface_ptr);
 	~wolf() {}
-	// implement functions that are purely virtual in base class
-	void move();
+	SPECIES species() const;
+};
+
+// Uniform grid over the ground used to find the animals of one species close
+// to a point without looking at the whole herd. It is rebuilt from scratch
+// with a counting sort: the indices of the animals of each cell are stored
+// next to each other in entries_, cell c spanning
+// [cell_start_[c], cell_start_[c + 1]). The cell size is picked at each
+// rebuild so that cells stay nearly empty however dense the herd gets, and
+// their number follows the size of the herd rather than that of the world.
+// Positions outside of the grid count as being in the closest border cell.
+class spatial_grid {
+private:
+	int width_, height_;
+	int max_cell_size_;
+	int cell_size_;
+	int columns_, rows_;
+	std::vector<Uint32> cell_start_;
+	std::vector<Uint32> entries_;
+	std::vector<Uint32> cell_of_; // Cell of each animal, kept between rebuilds
+								  // to avoid reallocating
+public:
+	spatial_grid(int width, int height, int max_cell_size);
+
+	// Index the animals of the given species among the count first ones
+	void rebuild(const int* x, const int* y, const Uint8* species_of,
+		SPECIES species, size_t count);
+
+	int cell_size() const;
+	int columns() const;
+	int rows() const;
+	int column_of(int x) const;
+	int row_of(int y) const;
+
+	// Animals in the cell at (column, row), which must be inside the grid
+	const Uint32* cell_begin(int column, int row) const;
+	const Uint32* cell_end(int column, int row) const;
+};
+
+// Names an animal for as long as it lives, whatever the removal of other
+// animals does to its index. Entries of the handle table are reused once
+// their animal is removed, the generation tells the handles of the old
+// animal from those of the new one.
+struct animal_handle {
+	Uint32 entry;
+	Uint32 generation;
+};
+constexpr Uint32 no_index = ~Uint32(0);
 
+// Additions and removals of animals requested while the herd cannot change,
+// during the movement step, and applied in order at the end of the step
+class command_buffer {
+public:
+	struct command {
+		animal_handle handle; // Animal to remove
+		SPECIES species; // Of the animal to add, SPECIES_COUNT for a removal
+	};
+private:
+	std::vector<command> commands_;
+public:
+	void add_animal(SPECIES species);
+	void remove_animal(animal_handle handle);
+
+	const std::vector<command>& commands() const;
+	bool empty() const;
+	void clear();
 };
-// Use only sheep at first. Once the application works
-// for sheep you can add the wolves
 
-// The "ground" on which all the animals live (like the std::vector
-// in the zoo example).
+// The "ground" on which all the animals live. The herd is stored as a
+// structure of arrays: animal i is at (x_[i], y_[i]), walks toward
+// (target_x_[i], target_y_[i]) and is described by species_[species_of_[i]].
+// The movement step only streams through the integer arrays, one chunk of
+// chunk_size animals per task. Each chunk draws its random targets from its
+// own generator, so a run only depends on the seed, not on the number of
+// threads. These columns are the only storage of the animals: there is no
+// object per animal, and a removal moves the last animal into the hole, so
+// that the herd stays contiguous without going through the allocator.
 class ground {
 private:
-	// Attention, NON-OWNING ptr, again to the screen
+	// Attention, NON-OWNING ptrs, again to the screen. Only one of them is
+	// set, depending on the render backend
 	SDL_Surface* window_surface_ptr_;
+	SDL_Renderer* renderer_ptr_;
+
+	std::unique_ptr<sprite_atlas> atlas_; // NULL when headless
+	std::unique_ptr<animal> species_[SPECIES_COUNT];
+
+	int world_width_, world_height_;
+	int view_width_, view_height_; // Of the window
+	int boundary_; // Animals stay that far away from the borders of the world
+	bool default_config_; // Boundary and retarget radii are the defaults, see
+						  // retarget
+	// World point (x, y) is drawn at ((x - camera_x_) * zoom_,
+	// (y - camera_y_) * zoom_) in the window
+	double camera_x_, camera_y_, zoom_;
+	std::vector<Uint32> visible_; // Animals which may be in the window, in
+								  // drawing order, see find_visible. Emptied
+								  // when the herd shrinks.
+	Uint32 steps_since_visible_; // Movement steps since the last find_visible
+
+	std::vector<int> x_, y_;
+	std::vector<int> previous_x_, previous_y_; // Positions before the last step
+	std::vector<int> target_x_, target_y_;
+	std::vector<Uint8> species_of_;
+	std::vector<Uint16> rest_; // Steps before a predator hunts again
+	std::vector<Uint8> arrived_; // Set by the movement step for the animals
+								 // which reached their target
+	std::vector<Uint32> handle_entry_; // Handle table entry of each animal
+
+	// Handle table
+	std::vector<Uint32> entry_index_; // Index of the animal of each entry,
+									  // no_index when the entry is free
+	std::vector<Uint32> entry_generation_;
+	std::vector<Uint32> free_entries_;
 
-	std::vector<std::shared_ptr<animal>> animals_;
+	size_t species_count_[SPECIES_COUNT];
+	std::vector<spatial_grid> grids_; // One per species, positions as of the
+									  // end of the last movement step
+	bool grids_dirty_; // Animals were added since the last rebuild
+
+	SIMD_LEVEL move_kernel_;
+	Uint64 seed_;
+	random_generator generator_; // Used outside of the movement step
+
+	std::unique_ptr<worker_pool> workers_;
+	std::vector<random_generator> chunk_generators_;
+	std::vector<std::vector<Uint32>> chunk_retarget_lists_; // Animals which
+								// reached their target in each chunk
+	std::vector<command_buffer> chunk_commands_; // Prey caught by the animals
+								// of each chunk
+	std::mutex queue_mutex_;
+	command_buffer queued_commands_, applied_commands_;
+
+	// Draw calls of the whole herd for the renderer backend, refilled at
+	// every frame
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	std::vector<SDL_Vertex> batch_vertices_;
+	std::vector<int> batch_indices_;
+#endif
+
+	// Dirty rectangle tracking for the surface backend, in window pixels
+	std::vector<int> drawn_x_, drawn_y_; // Where each animal was last drawn,
+										 // only kept up to date while visible
+	std::vector<SDL_Rect> vacated_rects_; // Last drawn rects of removed animals
+	std::vector<Uint8> dirty_tiles_;
+	size_t dirty_tile_count_;
+	std::vector<SDL_Rect> dirty_rects_;
+	int tile_columns_, tile_rows_;
+	bool full_repaint_; // Nothing drawn yet, or animals were added
+	Uint32 background_color_;
+
+	// Tile compositor: the animals over each dirty tile, in drawing order,
+	// are those of tile_animals_ from tile_bins_[tile] to tile_bins_[tile + 1]
+	double lod_coverage_; // See set_lod_coverage
+	bool lod_; // See lod
+	std::vector<SDL_Point> impostor_points_; // Renderer backend, per species
+	bool compositor_; // The atlas can be blended by blend_sprite
+	std::vector<Uint32> painted_tiles_;
+	std::vector<Uint32> tile_bins_;
+	std::vector<Uint32> tile_animals_;
+
+	// Keep the animals boundary pixels away from the borders, every species
+	// picking its targets within retarget_radius
+	void configure(int boundary, int retarget_radius);
+	void retarget(random_generator& generator, const Uint32* indices, size_t count);
+	// Same, specialized for the default boundary and retarget radius, the
+	// bounds of the targets then being known at compile time
+	template <bool default_config>
+	void retarget_with(random_generator& generator, const Uint32* indices, size_t count);
+	// Chase the closest prey in sight unless resting after a catch, or else
+	// run away from the closest predator in sight
+	void steer_chunk(size_t chunk);
+	void move_chunk(size_t chunk);
+	void apply(command_buffer& commands);
+	void rebuild_grids();
+	// Fill visible_ with the animals close enough to the window to be seen,
+	// or to have been seen at the last call, found through the spatial grids
+	// when the window only shows part of the world
+	void find_visible();
+	// Whether the animals in visible_ are dense enough to be drawn as single
+	// pixels, see set_lod_coverage
+	bool choose_lod() const;
+	// Where an animal is drawn in the window, 'weight' out of 256 of the
+	// way from its previous position to its current one
+	SDL_Rect screen_rect(size_t index, int weight) const;
+	void draw_sprite(size_t index, const SDL_Rect& rect) const;
+	void draw_batched(double interpolation);
+	SDL_Rect drawn_rect(size_t index) const;
+	void mark_dirty(const SDL_Rect& rect);
+	SDL_Rect tile_rect(int column, int row) const;
+	// Clear and redraw the dirty tiles on the worker threads, each tile
+	// being written by a single thread
+	void composite();
+	void composite_tile(Uint32 tile);
+	// Draw every animal as one pixel at the center of its sprite
+	void draw_impostors(double interpolation);
 
 public:
-	ground(SDL_Surface* window_surface_ptr);
+	static constexpr size_t chunk_size = 16384;
+
+	// The animals live in the world of the configuration, of which the
+	// window shows the part seen by the camera
+	ground(SDL_Surface* window_surface_ptr, SDL_Renderer* renderer_ptr, Uint64 seed,
+		unsigned thread_count, const run_config& config = run_config());
 	~ground();
 
-	// Add an animal
-	void add_animal(std::shared_ptr<animal> newAnimal);
+	// Add an animal of the given species at a random position
+	animal_handle add_animal(SPECIES species);
+	// Remove an animal, in constant time, nothing happens if it is already
+	// gone. The last animal takes its index, handles stay valid.
+	void remove_animal(animal_handle handle);
+	void remove_animals(const animal_handle* handles, size_t count);
+	// Same as add_animal and remove_animal, but applied at the end of the
+	// next movement step. Unlike them they can be called from any thread,
+	// even while move() runs.
+	void queue_add_animal(SPECIES species);
+	void queue_remove_animal(animal_handle handle);
+	void reserve(size_t count);
+	size_t size() const;
+	size_t count(SPECIES species) const;
+	// Bytes held by the columns of the herd, including spare capacity
+	size_t memory_used() const;
+
+	bool alive(animal_handle handle) const;
+	// Current index of a living animal, -1 once it is removed
+	long index_of(animal_handle handle) const;
+	animal_handle handle_of(Uint32 index) const;
+
+	// Kernel used by move(), defaults to fastest_simd_level()
+	void set_move_kernel(SIMD_LEVEL kernel);
+	SIMD_LEVEL move_kernel() const;
+	unsigned thread_count() const;
+
+	// Pick a new random target for each of the count animals listed
+	void retarget(const Uint32* indices, size_t count);
+
+	int world_width() const;
+	int world_height() const;
+	int boundary() const;
+	int retarget_radius() const; // Of every species
+	// Move the camera to show the world from (x, y) on, zoom window pixels
+	// per world pixel. The zoom is kept between min_zoom and max_zoom, and
+	// the camera over the world, or centered on it when the whole world
+	// fits in the window.
+	void set_camera(double x, double y, double zoom);
+	// Move the camera by (dx, dy) window pixels
+	void pan(double dx, double dy);
+	// Zoom by factor, the world point under window point (x, y) staying put
+	void zoom_at(double factor, int x, int y);
+	double camera_x() const;
+	double camera_y() const;
+	double zoom() const;
+
+	SDL_Point position(Uint32 index) const;
+	SPECIES species_of(Uint32 index) const;
+
+	// Animals less than radius pixels away from (x, y), as of the last
+	// movement step
+	void query_radius(int x, int y, int radius, std::vector<Uint32>& result) const;
+	// Closest animal of the given species less than radius pixels away from
+	// (x, y) as of the last movement step, -1 if there is none
+	long nearest(int x, int y, int radius, SPECIES species) const;
+
+	// Steer the animals after their prey or away from their predators, walk
+	// every animal one step toward its target and pick a new target for
+	// those which reached it. Caught prey are then removed, the queued
+	// commands applied and the spatial grids refreshed.
+	void move();
+	// Draw the animals between their previous and current position,
+	// interpolation going from 0 (previous) to 1 (current). With the
+	// renderer backend the whole herd is submitted together. Only the
+	// animals in the window are drawn, and in a world larger than the
+	// window only those are even looked at. The window is expected to be
+	// cleared first, the next draw_dirty then repaints all of it.
+	void draw(double interpolation);
+	// Draw the animals as single pixels instead of sprites once the sprites
+	// of the animals in the window would cover each window pixel coverage
+	// times on average: the picture is then mostly overdraw and its cost
+	// only grows with the herd. Defaults to lod_coverage, 0 always draws
+	// the sprites.
+	void set_lod_coverage(double coverage);
+	// Whether the last call to draw or draw_dirty drew single pixels,
+	// false before the first one
+	bool lod() const;
+
+	// Repaint only the tiles that changed since the last call: clear them
+	// and redraw the animals over them, clipped to them. Falls back to
+	// clearing and redrawing everything when more than
+	// dirty_repaint_threshold of the tiles changed. Returns true when only
+	// dirty_rects() need to be presented.
+	// When the window has 32 bit pixels the tiles are painted in parallel,
+	// straight into the window pixels, instead of through SDL_BlitSurface.
+	bool draw_dirty(double interpolation);
+	const std::vector<SDL_Rect>& dirty_rects() const;
+	// Have the next draw_dirty repaint the given area, for what was drawn
+	// over the animals
+	void invalidate(const SDL_Rect& rect);
 
 	// "refresh the screen": Move animals and draw them
 	void update();
-	// todo: "refresh the screen": Move animals and draw them
-	// Possibly other methods, depends on your implementation
+
+	// Snapshot of everything the next movement steps depend on: the world
+	// size, the boundary, the retarget radius, the random generators and the
+	// herd. The camera, the thread count and the move kernel are left out
+	// since they do not change the outcome. The snapshot is a versioned
+	// header followed by the raw columns, in native byte order and aligned
+	// so that a mapped file can be read in place. Loading it costs one copy
+	// per column, however large the herd.
+	void save(std::ostream& out) const;
+	void load(const char* data, size_t size);
+	void save_file(const std::string& path) const;
+	// Maps the file instead of reading it
+	void load_file(const std::string& path);
+};
+
+// Empties the SDL event queue at each frame and hands every event to the
+// handlers registered for its type, in registration order, then to those
+// registered for SDL_FIRSTEVENT, which see every event. It also keeps
+// track of how long events waited in the queue before being handled.
+class event_pump {
+private:
+	std::map<Uint32, std::vector<std::function<void(const SDL_Event&)>>> handlers_;
+	Uint64 handled_count_;
+	Uint64 total_latency_; // In milliseconds
+	Uint32 max_latency_;
+public:
+	event_pump();
+
+	void add_handler(Uint32 type, std::function<void(const SDL_Event&)> handler);
+
+	// Handle every pending event, returns how many there were
+	size_t pump();
+
+	Uint64 handled_count() const;
+	double average_latency() const; // In milliseconds
+	Uint32 max_latency() const; // In milliseconds
+};
+
+// Parts of a frame measured by frame_profiler
+enum FRAME_PHASE
+{
+	EVENTS,   // Emptying the event queue
+	SIMULATE, // Movement steps
+	CLEAR,    // Clearing the window before a full redraw
+	DRAW,     // Drawing the animals and the overlay
+	PRESENT,  // Handing the frame over to the window
+	SLEEP,    // Waiting for the next frame
+	FRAME_PHASE_COUNT
+};
+
+// Time spent in each phase of the last 'history' frames, from the
+// performance counter. Statistics only cover finished frames, and
+// FRAME_PHASE_COUNT stands for the whole frame.
+class frame_profiler {
+private:
+	std::vector<Uint64> samples_; // FRAME_PHASE_COUNT counters per frame
+	size_t frame_count_; // Finished frames, including those overwritten
+	double frequency_;
+	bool overlay_;
+	std::vector<SDL_Rect> overlay_rects_[FRAME_PHASE_COUNT];
+	int window_height_;
+	double frame_time_;
+
+	double duration(size_t frame, FRAME_PHASE phase) const; // In milliseconds
+	// Bars of the overlay, one list of rectangles per phase
+	void layout_overlay();
+public:
+	static constexpr size_t history = 512;
+
+	frame_profiler(int window_height = frame_height, double frame_time = ::frame_time);
+
+	void begin_frame();
+	void add(FRAME_PHASE phase, Uint64 counter);
+	void end_frame();
+
+	// Finished frames still in the history
+	size_t frame_count() const;
+	// In milliseconds, fraction going from 0 (shortest) to 1 (longest)
+	double percentile(FRAME_PHASE phase, double fraction) const;
+	double mean(FRAME_PHASE phase) const;
+	static const char* phase_name(FRAME_PHASE phase);
+
+	void set_overlay(bool overlay);
+	bool overlay() const;
+	SDL_Rect overlay_rect() const;
+	// Stacked bars of the time spent in each phase, most recent frame on
+	// the right, with a line at frame_time
+	void draw_overlay(SDL_Surface* surface);
+	void draw_overlay(SDL_Renderer* renderer);
+
+	// Mean, p50, p99 and maximum of each phase, as text or CSV
+	void report(std::ostream& out) const;
+	void write_csv(const std::string& path) const;
+};
+
+// Adds the time between its construction and its destruction to one
+// phase of the current frame
+class scoped_timer {
+private:
+	frame_profiler& profiler_;
+	FRAME_PHASE phase_;
+	Uint64 start_;
+public:
+	scoped_timer(frame_profiler& profiler, FRAME_PHASE phase);
+	~scoped_timer();
+};
+
+// Replay files start with a header holding what the run was created from,
+// followed by records, each starting with its REPLAY_RECORD kind and the
+// step before which it happened:
+//   EVENT    event type, then key for key events, window event for window
+//            events, 0 otherwise (Uint32 each)
+//   SNAPSHOT size (Uint64), then the ground::save snapshot of the ground
+//            at that step
+//   END      nothing, marks a run which ended normally
+// Every number is in native byte order.
+enum REPLAY_RECORD : Uint8
+{
+	EVENT,
+	SNAPSHOT,
+	END
+};
+
+struct replay_event {
+	Uint32 tick;
+	Uint32 type;
+	Uint32 detail;
+};
+
+struct replay_snapshot {
+	Uint32 tick;
+	std::streamoff offset; // Of the ground data in the file
+	Uint64 size;
+};
+
+class replay_writer {
+private:
+	std::ofstream out_;
+public:
+	// The world, the boundary and the retarget radius are those of state
+	replay_writer(const std::string& path, Uint64 seed, Uint32 n_sheep, Uint32 n_wolf,
+		const ground& state);
+	~replay_writer();
+
+	void write_event(Uint32 tick, const SDL_Event& event);
+	void write_snapshot(Uint32 tick, const ground& state);
+	// Snapshot the final state of the ground, so that a replay can check
+	// it reaches it too, then mark the run as complete
+	void write_end(Uint32 tick, const ground& state);
+};
+
+// Reads the header and the index of a replay file. Snapshots are only read
+// when asked for, a long recording of a large herd does not fit in memory.
+class replay_reader {
+private:
+	mutable std::ifstream in_;
+	Uint64 seed_;
+	Uint32 n_sheep_, n_wolf_;
+	Uint32 world_width_, world_height_;
+	Uint32 boundary_;
+	Sint32 retarget_radius_;
+	Uint32 tick_count_; // Of the recorded run
+	bool complete_; // The run ended normally
+	std::vector<replay_event> events_;
+	std::vector<replay_snapshot> snapshots_; // By increasing tick
+public:
+	explicit replay_reader(const std::string& path);
+
+	Uint64 seed() const;
+	Uint32 sheep_count() const;
+	Uint32 wolf_count() const;
+	Uint32 world_width() const;
+	Uint32 world_height() const;
+	Uint32 boundary() const;
+	int retarget_radius() const;
+	Uint32 tick_count() const;
+	bool complete() const;
+	const std::vector<replay_event>& events() const;
+	const std::vector<replay_snapshot>& snapshots() const;
+
+	// Latest snapshot taken at or before tick, NULL if there is none
+	const replay_snapshot* snapshot_before(Uint32 tick) const;
+	std::string snapshot_data(const replay_snapshot& snapshot) const;
 };
 
 // The application class, which is in charge of generating the window
 class application {
 private:
-	// The following are OWNING ptrs
+	// The following are OWNING ptrs, all null when running headless. Only
+	// one of the surface and the renderer is used, see RENDER_BACKEND
 	SDL_Window* window_ptr_;
 	SDL_Surface* window_surface_ptr_;
-	SDL_Event window_event_;
+	SDL_Renderer* renderer_ptr_;
+
+	run_config config_;
+	event_pump events_;
+	bool running_; // Cleared by the event handlers to leave the main loop
+
+	frame_profiler profiler_;
+	std::string profile_path_; // CSV written at exit, none if empty
+
+	Uint32 tick_count_; // Movement steps since the start
+	std::unique_ptr<replay_writer> recorder_;
+	std::string snapshot_path_; // Saved at exit, none if empty
+
+	// One movement step, snapshotted when recording
+	void step();
 
 	std::unique_ptr<ground> ground_;
+	bool full_repaint_; // Repaint the whole surface at each frame instead
+						// of its dirty rectangles
 public:
-	application(unsigned n_sheep, unsigned n_wolf);
+	// Arrow keys and dragging with the left mouse button move the camera,
+	// the mouse wheel and +/- zoom it
+	application(unsigned n_sheep, unsigned n_wolf, Uint64 seed, bool headless,
+		unsigned thread_count, RENDER_BACKEND backend,
+		const run_config& config = run_config());
 	~application();
 
+	void set_full_repaint(bool full_repaint);
+	// See ground::set_lod_coverage
+	void set_lod_coverage(double coverage);
+	// Show the frame time overlay from the start, F1 toggles it anyway
+	void set_profile_overlay(bool overlay);
+	// Write the frame time statistics to a CSV file at exit
+	void set_profile_output(const std::string& path);
+	// Record the run to a replay file, the application must be the one
+	// created from the seed and herd sizes given, the world is taken from
+	// the ground
+	void record(const std::string& path, Uint64 seed, unsigned n_sheep, unsigned n_wolf);
+	// Replace the herd with a snapshot saved by ground::save_file, before
+	// recording or running
+	void load_snapshot(const std::string& path);
+	// Save the ground to a snapshot file when the run ends
+	void set_snapshot_output(const std::string& path);
+
+	// Simulate 'period' seconds as fast as possible without drawing,
+	// then report the simulation speed
+	int run_headless(unsigned period);
+
+	// Play a replay recorded with the same seed and herd sizes without
+	// drawing: start from the closest snapshot before 'seek', simulate up to
+	// it, then carry on to the end of the recording, checking that each
+	// snapshot met on the way is matched exactly
+	int run_replay(const replay_reader& replay, Uint32 seek);
+
 	int loop(unsigned period);
 	// main loop of the application.
-							   // this ensures that the screen is updated
-							   // at the correct rate.
-							   // See SDL_GetTicks() and SDL_Delay() to enforce a
-							   // duration the application should terminate after
-							   // 'period' seconds
+							   // The simulation advances in fixed steps of
+							   // tick_time, whatever the time spent drawing,
+							   // and frames are drawn at up to the frame rate
+							   // of the configuration,
+							   // interpolating between the last two steps.
+							   // The application terminates after
+							   // 'period' seconds. Headless applications
+							   // use run_headless instead.
 };
 
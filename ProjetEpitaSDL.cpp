@@ -1,25 +1,166 @@
 #include "Project_SDL1.h"
 #include <iostream>
+#include <memory>
+#include <random>
 #include <string>
+#include <vector>
 
 int main(int argc, char* argv[]) {
 
 	std::cout << "Starting up the application" << std::endl;
 
-	if (argc != 4)
+	// Three positional arguments, options may come anywhere
+	std::vector<std::string> arguments;
+	Uint64 seed = std::random_device()();
+	bool headless = false;
+	unsigned thread_count = SDL_GetCPUCount();
+	RENDER_BACKEND backend = RENDER_BACKEND::SURFACE;
+	bool full_repaint = false;
+	double coverage = lod_coverage;
+	run_config config;
+	bool overlay = false;
+	std::string profile_path;
+	std::string record_path;
+	std::string replay_path;
+	Uint32 seek = 0;
+	std::string load_path;
+	std::string save_path;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--seed" && i + 1 < argc)
+			seed = std::stoull(argv[++i]);
+		else if (argument == "--headless")
+			headless = true;
+		else if (argument == "--threads" && i + 1 < argc)
+			thread_count = std::stoul(argv[++i]);
+		else if (argument == "--full-repaint")
+			full_repaint = true;
+		else if (argument == "--world" && i + 1 < argc) {
+			std::string size = argv[++i];
+			size_t separator = size.find('x');
+			if (separator == std::string::npos)
+				throw std::runtime_error("Expected --world <width>x<height>, got " + size + "\n");
+			config.set("world_width", size.substr(0, separator));
+			config.set("world_height", size.substr(separator + 1));
+		}
+		else if (argument == "--config" && i + 1 < argc)
+			config.load(argv[++i]);
+		else if (argument == "--set" && i + 1 < argc) {
+			std::string parameter = argv[++i];
+			size_t separator = parameter.find('=');
+			if (separator == std::string::npos)
+				throw std::runtime_error("Expected --set <name>=<value>, got " + parameter + "\n");
+			config.set(parameter.substr(0, separator), parameter.substr(separator + 1));
+		}
+		else if (argument == "--lod" && i + 1 < argc)
+			coverage = std::stod(argv[++i]);
+		else if (argument == "--overlay")
+			overlay = true;
+		else if (argument == "--profile" && i + 1 < argc)
+			profile_path = argv[++i];
+		else if (argument == "--record" && i + 1 < argc)
+			record_path = argv[++i];
+		else if (argument == "--replay" && i + 1 < argc)
+			replay_path = argv[++i];
+		else if (argument == "--seek" && i + 1 < argc)
+			seek = std::stoul(argv[++i]);
+		else if (argument == "--load" && i + 1 < argc)
+			load_path = argv[++i];
+		else if (argument == "--save" && i + 1 < argc)
+			save_path = argv[++i];
+		else if (argument == "--backend" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (name == "surface")
+				backend = RENDER_BACKEND::SURFACE;
+			else if (name == "renderer")
+				backend = RENDER_BACKEND::ACCELERATED_RENDERER;
+			else if (name == "software")
+				backend = RENDER_BACKEND::SOFTWARE_RENDERER;
+			else
+				throw std::runtime_error("Unknown backend " + name +
+					", expected surface, renderer or software\n");
+		}
+		else
+			arguments.push_back(argument);
+	}
+
+	// A replay brings its own seed and herd, and is played headless
+	std::unique_ptr<replay_reader> replay;
+	if (!replay_path.empty()) {
+		replay = std::make_unique<replay_reader>(replay_path);
+		seed = replay->seed();
+		headless = true;
+		config.world_width = replay->world_width();
+		config.world_height = replay->world_height();
+		config.frame_boundary = replay->boundary();
+		config.retarget_radius = replay->retarget_radius();
+		arguments = { std::to_string(replay->sheep_count()),
+			std::to_string(replay->wolf_count()), "0" };
+	}
+
+	if (arguments.size() != 3)
 		throw std::runtime_error("Need three arguments - "
 			"number of sheep, number of wolves, "
-			"simulation time in seconde\n");
+			"simulation time in seconde\n"
+			"Options: --seed <n> to replay a previous run\n"
+			"         --headless to simulate as fast as possible without a window\n"
+			"         --threads <n> to move the animals on n threads\n"
+			"         --backend surface|renderer|software to pick how frames are drawn\n"
+			"         --full-repaint to redraw the whole surface at each frame\n"
+			"         --world <width>x<height> to let the animals roam a world of\n"
+			"                                  that size, seen through a camera\n"
+			"         --config <file> to read \"name = value\" lines setting any of\n"
+			"                         frame_rate, frame_width, frame_height,\n"
+			"                         frame_boundary, retarget_radius, world_width\n"
+			"                         and world_height\n"
+			"         --set <name>=<value> to set one of them, after the file\n"
+			"         --lod <coverage> to draw the animals as single pixels once\n"
+			"                          their sprites cover each pixel that many\n"
+			"                          times on average, 0 to never do it\n"
+			"         --overlay to show the frame times, F1 toggles it\n"
+			"         --profile <file> to write frame time statistics as CSV\n"
+			"         --record <file> to record the run for --replay\n"
+			"         --replay <file> to play a recorded run headless, instead of\n"
+			"                         the three arguments\n"
+			"         --seek <step> to start playing the replay from that step\n"
+			"         --load <file> to start from a saved ground, the numbers of\n"
+			"                       sheep and wolves are then ignored\n"
+			"         --save <file> to save the ground when the run ends\n");
+
+	init(headless);
+
+	std::cout << "Done with initilization, seed " << seed << std::endl;
+
+	Uint32 startup_ticks = SDL_GetTicks();
+
+	// A saved ground replaces the new herd altogether
+	if (!load_path.empty())
+		arguments[0] = arguments[1] = "0";
 
-	init();
+	application my_app(std::stoul(arguments[0]), std::stoul(arguments[1]), seed,
+		headless, thread_count, backend, config);
 
-	std::cout << "Done with initilization" << std::endl;
+	my_app.set_full_repaint(full_repaint);
+	my_app.set_lod_coverage(coverage);
+	my_app.set_profile_overlay(overlay);
+	my_app.set_profile_output(profile_path);
 
-	application my_app(std::stoul(argv[1]), std::stoul(argv[2]));
+	std::cout << "Created window and herd in "
+		<< SDL_GetTicks() - startup_ticks << " ms" << std::endl;
 
-	std::cout << "Created window" << std::endl;
+	if (!load_path.empty()) {
+		Uint32 load_ticks = SDL_GetTicks();
+		my_app.load_snapshot(load_path);
+		std::cout << "Loaded " << load_path << " in "
+			<< SDL_GetTicks() - load_ticks << " ms" << std::endl;
+	}
+	my_app.set_snapshot_output(save_path);
+	if (!record_path.empty())
+		my_app.record(record_path, seed, std::stoul(arguments[0]), std::stoul(arguments[1]));
 
-	int retval = my_app.loop(std::stoul(argv[3]));
+	int retval = replay ? my_app.run_replay(*replay, seek)
+		: headless ? my_app.run_headless(std::stoul(arguments[2]))
+		: my_app.loop(std::stoul(arguments[2]));
 
 	std::cout << "Exiting application with code " << retval << std::endl;
 
@@ -0,0 +1,603 @@
+#include "Project_SDL1.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+	// Started by the benchmarks once their setup is done, and read when
+	// they return. The note is printed after the timings.
+	struct stopwatch {
+		Uint64 start_counter = SDL_GetPerformanceCounter();
+		std::string note;
+		void start() { start_counter = SDL_GetPerformanceCounter(); }
+	};
+
+	// Minimal benchmark harness: the body of a benchmark runs its work
+	// 'iterations' times, and the number of iterations doubles until one
+	// run lasts at least min_time seconds
+	struct benchmark {
+		std::string name;
+		double items_per_iteration; // For the throughput column
+		std::function<void(size_t iterations, stopwatch& watch)> body;
+	};
+
+	// Checked before the benchmarks run, the bench exits with 1 if any of
+	// them fails. The body returns what went wrong, nothing if all is well.
+	struct check {
+		std::string name;
+		std::function<std::string()> body;
+	};
+
+	// Results written there cannot be optimized away
+	volatile Uint64 sink;
+
+	struct surface_deleter {
+		void operator()(SDL_Surface* surface) const { SDL_FreeSurface(surface); }
+	};
+	using surface_ptr = std::unique_ptr<SDL_Surface, surface_deleter>;
+
+	// Stand-in for the window surface, in the usual window pixel format
+	surface_ptr create_offscreen_surface() {
+		SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, frame_width, frame_height,
+			32, SDL_PIXELFORMAT_RGB888);
+		if (!surface)
+			throw std::runtime_error("create_offscreen_surface(): " +
+				std::string(SDL_GetError()));
+		return surface_ptr(surface);
+	}
+
+	std::unique_ptr<ground> create_herd(SDL_Surface* surface, size_t n_sheep, size_t n_wolf,
+		unsigned thread_count) {
+		auto herd = std::make_unique<ground>(surface, nullptr, 42, thread_count);
+		herd->reserve(n_sheep + n_wolf);
+		for (size_t i = 0; i < n_sheep; i++)
+			herd->add_animal(SPECIES::SHEEP);
+		for (size_t i = 0; i < n_wolf; i++)
+			herd->add_animal(SPECIES::WOLF);
+		return herd;
+	}
+
+	// Colors of a straight alpha pixel times its alpha / 255, rounded to the
+	// nearest, as blend_row wants them
+	Uint32 premultiply(Uint32 pixel) {
+		Uint32 alpha = pixel >> 24;
+		Uint32 result = alpha << 24;
+		for (int shift = 0; shift < 24; shift += 8)
+			result |= ((pixel >> shift & 0xff) * alpha * 2 + 255) / 510 << shift;
+		return result;
+	}
+
+	// Every pair of sprite and target byte values, on each byte, the sprite
+	// pixels having the given alpha, before and after being premultiplied
+	void blend_inputs(Uint32 alpha, std::vector<Uint32>& straight, std::vector<Uint32>& sprite,
+		std::vector<Uint32>& target) {
+		straight.resize(256 * 256);
+		sprite.resize(256 * 256);
+		target.resize(256 * 256);
+		for (Uint32 i = 0; i < 256 * 256; i++)
+		{
+			Uint32 s = i & 0xff, d = i >> 8;
+			straight[i] = alpha << 24 | s << 16 | (255 - s) << 8 | (s ^ 0x5a);
+			sprite[i] = premultiply(straight[i]);
+			target[i] = d << 24 | (d ^ 0xa5) << 16 | d << 8 | (255 - d);
+		}
+	}
+
+	const char* kernel_name(SIMD_LEVEL kernel) {
+		switch (kernel)
+		{
+		case SIMD_LEVEL::SSE2:
+			return "sse2";
+		case SIMD_LEVEL::AVX2:
+			return "avx2";
+		default:
+			return "scalar";
+		}
+	}
+
+	std::vector<check> all_checks() {
+		std::vector<check> checks;
+
+		// Blending a straight alpha sprite, once premultiplied, lands within
+		// one level of the exact blend on every byte, for every alpha and
+		// every pair of sprite and target bytes. The target alpha byte gets
+		// the alpha of the sprite drawn over it.
+		checks.push_back({ "blend_row/scalar within one level", []() {
+			std::vector<Uint32> straight, sprite, target;
+			for (Uint32 alpha = 0; alpha < 256; alpha++)
+			{
+				blend_inputs(alpha, straight, sprite, target);
+				std::vector<Uint32> blended = target;
+				blend_row(blended.data(), sprite.data(), int(sprite.size()), SIMD_LEVEL::SCALAR);
+				for (size_t i = 0; i < blended.size(); i++)
+				{
+					for (int shift = 0; shift < 32; shift += 8)
+					{
+						double source = shift == 24 ? 255. : double(straight[i] >> shift & 0xff);
+						double exact = (source * alpha +
+							double(target[i] >> shift & 0xff) * (255. - alpha)) / 255.;
+						if (std::abs(double(blended[i] >> shift & 0xff) - exact) >= 1.)
+							return "byte " + std::to_string(shift / 8) + " of pixel " +
+								std::to_string(i) + " at alpha " + std::to_string(alpha);
+					}
+				}
+			}
+			return std::string();
+		} });
+
+		// The vector blend kernels give the same bytes as the scalar one,
+		// over the same inputs shifted by a pixel so that the rows end with a
+		// partial vector, then over pixels of random alphas
+		for (SIMD_LEVEL kernel : { SIMD_LEVEL::SSE2, SIMD_LEVEL::AVX2 })
+		{
+			if (kernel > fastest_simd_level())
+				continue;
+			checks.push_back({ std::string("blend_row/") + kernel_name(kernel) + " matches scalar",
+				[kernel]() {
+				std::vector<Uint32> straight, sprite, target;
+				for (Uint32 alpha = 0; alpha <= 256; alpha++)
+				{
+					if (alpha < 256)
+						blend_inputs(alpha, straight, sprite, target);
+					else
+					{
+						random_generator generator(1);
+						for (size_t i = 0; i < sprite.size(); i++)
+						{
+							sprite[i] = premultiply(generator.next());
+							target[i] = generator.next();
+						}
+					}
+					std::vector<Uint32> expected = target, blended = target;
+					int count = int(sprite.size()) - 1;
+					blend_row(expected.data() + 1, sprite.data() + 1, count, SIMD_LEVEL::SCALAR);
+					blend_row(blended.data() + 1, sprite.data() + 1, count, kernel);
+					for (size_t i = 0; i < blended.size(); i++)
+					{
+						if (blended[i] != expected[i])
+							return "pixel " + std::to_string(i) + (alpha < 256 ?
+								" at alpha " + std::to_string(alpha) : " of random alphas");
+					}
+				}
+				return std::string();
+			} });
+		}
+
+		// The vector kernels move the herd exactly like the scalar one. The
+		// herd size is not a multiple of the vector width, and the wolves
+		// catch sheep, so removals are covered too.
+		for (SIMD_LEVEL kernel : { SIMD_LEVEL::SSE2, SIMD_LEVEL::AVX2 })
+		{
+			if (kernel > fastest_simd_level())
+				continue;
+			checks.push_back({ std::string("move/") + kernel_name(kernel) + " matches scalar",
+				[kernel]() {
+				std::unique_ptr<ground> expected = create_herd(nullptr, 10007, 100, 1);
+				std::unique_ptr<ground> herd = create_herd(nullptr, 10007, 100, 1);
+				expected->set_move_kernel(SIMD_LEVEL::SCALAR);
+				herd->set_move_kernel(kernel);
+				for (int step = 1; step <= 500; step++)
+				{
+					expected->move();
+					herd->move();
+					if (herd->size() != expected->size())
+						return "herd size differs after step " + std::to_string(step);
+					for (Uint32 i = 0; i < herd->size(); i++)
+					{
+						SDL_Point position = herd->position(i);
+						SDL_Point expected_position = expected->position(i);
+						if (position.x != expected_position.x || position.y != expected_position.y)
+							return "animal " + std::to_string(i) + " differs after step " +
+								std::to_string(step);
+					}
+				}
+				return std::string();
+			} });
+		}
+		return checks;
+	}
+
+	std::vector<benchmark> all_benchmarks(SDL_Surface* surface) {
+		std::vector<benchmark> benchmarks;
+
+		benchmarks.push_back({ "random_generator::between", 1, [](size_t iterations, stopwatch&) {
+			random_generator generator(1);
+			Uint64 total = 0;
+			for (size_t i = 0; i < iterations; i++)
+				total += generator.between(0, 1000);
+			sink = total;
+		} });
+
+		benchmarks.push_back({ "animal::getRandomTarget", 1, [](size_t iterations, stopwatch&) {
+			random_generator generator(1);
+			Uint64 total = 0;
+			for (size_t i = 0; i < iterations; i++)
+				total += animal::getRandomTarget(generator, int(i % frame_width), 100,
+					frame_width);
+			sink = total;
+		} });
+
+		benchmarks.push_back({ "animal::draw", 1, [surface](size_t iterations, stopwatch& watch) {
+			sprite_atlas atlas({ sheep::sprite_path, wolf::sprite_path }, surface, nullptr);
+			sheep description(&atlas, surface);
+			random_generator generator(1);
+			watch.start();
+			for (size_t i = 0; i < iterations; i++)
+				description.draw(animal::getRandomSpawn(generator, frame_width),
+					animal::getRandomSpawn(generator, frame_height));
+		} });
+
+		// Items are pixels. The sprite holds every alpha value, one per column.
+		// The note gives the largest difference from SDL_BlitSurface with the
+		// same straight alpha sprite, which rounds its own way.
+		for (SIMD_LEVEL kernel : { SIMD_LEVEL::SCALAR, SIMD_LEVEL::SSE2, SIMD_LEVEL::AVX2 })
+		{
+			if (kernel > fastest_simd_level())
+				continue;
+			benchmarks.push_back({ std::string("blend_row/256x256/") + kernel_name(kernel),
+				256 * 256, [kernel](size_t iterations, stopwatch& watch) {
+				surface_ptr sprite(SDL_CreateRGBSurfaceWithFormat(0, 256, 256, 32,
+					SDL_PIXELFORMAT_ARGB8888));
+				surface_ptr expected(SDL_CreateRGBSurfaceWithFormat(0, 256, 256, 32,
+					SDL_PIXELFORMAT_RGB888));
+				surface_ptr target(SDL_CreateRGBSurfaceWithFormat(0, 256, 256, 32,
+					SDL_PIXELFORMAT_RGB888));
+				if (!sprite || !expected || !target)
+					throw std::runtime_error("blend_row: " + std::string(SDL_GetError()));
+				std::vector<Uint32> premultiplied(256 * 256);
+				random_generator generator(1);
+				for (int row = 0; row < 256; row++)
+				{
+					Uint32* sprite_row = reinterpret_cast<Uint32*>(
+						static_cast<Uint8*>(sprite->pixels) + row * sprite->pitch);
+					Uint32* target_row = reinterpret_cast<Uint32*>(
+						static_cast<Uint8*>(target->pixels) + row * target->pitch);
+					for (int column = 0; column < 256; column++)
+					{
+						sprite_row[column] = Uint32(column) << 24 | generator.next() >> 8;
+						premultiplied[row * 256 + column] = premultiply(sprite_row[column]);
+						target_row[column] = generator.next() >> 8;
+					}
+				}
+				SDL_BlitSurface(target.get(), NULL, expected.get(), NULL);
+				SDL_SetSurfaceBlendMode(sprite.get(), SDL_BLENDMODE_BLEND);
+				SDL_BlitSurface(sprite.get(), NULL, expected.get(), NULL);
+
+				auto blend = [&]() {
+					for (int row = 0; row < 256; row++)
+						blend_row(reinterpret_cast<Uint32*>(
+							static_cast<Uint8*>(target->pixels) + row * target->pitch),
+							premultiplied.data() + row * 256, 256, kernel);
+				};
+				blend();
+				int difference = 0;
+				for (int row = 0; row < 256; row++)
+				{
+					const Uint32* expected_row = reinterpret_cast<const Uint32*>(
+						static_cast<const Uint8*>(expected->pixels) + row * expected->pitch);
+					const Uint32* target_row = reinterpret_cast<const Uint32*>(
+						static_cast<const Uint8*>(target->pixels) + row * target->pitch);
+					for (int column = 0; column < 256; column++)
+					{
+						for (int shift = 0; shift < 24; shift += 8)
+							difference = std::max(difference, std::abs(
+								int(expected_row[column] >> shift & 0xff) -
+								int(target_row[column] >> shift & 0xff)));
+					}
+				}
+				watch.note = "at most " + std::to_string(difference) +
+					" from SDL_BlitSurface";
+
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+					blend();
+			} });
+		}
+
+		// Only sheep, so that the herd keeps the same size however long it runs
+		for (size_t herd_size : { 1000, 10000, 100000 })
+		{
+			for (SIMD_LEVEL kernel : { SIMD_LEVEL::SCALAR, SIMD_LEVEL::SSE2, SIMD_LEVEL::AVX2 })
+			{
+				if (kernel > fastest_simd_level())
+					continue;
+				benchmarks.push_back({ "ground::move/" + std::to_string(herd_size) + "/" +
+					kernel_name(kernel), double(herd_size),
+					[surface, herd_size, kernel](size_t iterations, stopwatch& watch) {
+					std::unique_ptr<ground> herd = create_herd(surface, herd_size, 0, 1);
+					herd->set_move_kernel(kernel);
+					watch.start();
+					for (size_t i = 0; i < iterations; i++)
+						herd->move();
+				} });
+			}
+
+			unsigned thread_count = SDL_GetCPUCount();
+			benchmarks.push_back({ "ground::move/" + std::to_string(herd_size) + "/" +
+				std::to_string(thread_count) + " threads", double(herd_size),
+				[surface, herd_size, thread_count](size_t iterations, stopwatch& watch) {
+				std::unique_ptr<ground> herd = create_herd(surface, herd_size, 0, thread_count);
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+					herd->move();
+			} });
+
+			benchmarks.push_back({ "ground::update/" + std::to_string(herd_size), double(herd_size),
+				[surface, herd_size](size_t iterations, stopwatch& watch) {
+				std::unique_ptr<ground> herd = create_herd(surface, herd_size, 0, 1);
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+					herd->update();
+			} });
+
+			benchmarks.push_back({ "ground::draw_dirty/" + std::to_string(herd_size),
+				double(herd_size), [surface, herd_size](size_t iterations, stopwatch& watch) {
+				std::unique_ptr<ground> herd = create_herd(surface, herd_size, 0, 1);
+				herd->set_lod_coverage(0);
+				herd->draw_dirty(1.);
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+				{
+					herd->move();
+					herd->draw_dirty(1.);
+				}
+			} });
+		}
+
+		// The tiles are painted on the worker threads
+		for (unsigned thread_count : { 2u, 4u, unsigned(SDL_GetCPUCount()) })
+		{
+			benchmarks.push_back({ "ground::draw_dirty/100000/" + std::to_string(thread_count) +
+				" threads", 100000, [surface, thread_count](size_t iterations, stopwatch& watch) {
+				std::unique_ptr<ground> herd = create_herd(surface, 100000, 0, thread_count);
+				herd->set_lod_coverage(0);
+				herd->draw_dirty(1.);
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+				{
+					herd->move();
+					herd->draw_dirty(1.);
+				}
+			} });
+		}
+
+		// Past lod_coverage the cost per animal no longer depends on the herd size
+		for (size_t herd_size : { 10000, 100000, 1000000 })
+		{
+			benchmarks.push_back({ "ground::draw_dirty/" + std::to_string(herd_size) + "/lod",
+				double(herd_size), [surface, herd_size](size_t iterations, stopwatch& watch) {
+				std::unique_ptr<ground> herd = create_herd(surface, herd_size, 0, 1);
+				herd->draw_dirty(1.);
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+				{
+					herd->move();
+					herd->draw_dirty(1.);
+				}
+				watch.note = herd->lod() ? "" : "sprites, under lod_coverage";
+			} });
+		}
+
+		// The window shows a hundredth of the world, about 10000 animals, and
+		// drawing only looks at those. Drawing alternates between the two
+		// last positions, no movement step is timed.
+		benchmarks.push_back({ "ground::draw_dirty/1000000/7000x4500", 1000000,
+			[surface](size_t iterations, stopwatch& watch) {
+			run_config config;
+			config.world_width = 7000;
+			config.world_height = 4500;
+			auto herd = std::make_unique<ground>(surface, nullptr, 42, 1, config);
+			herd->set_lod_coverage(0);
+			herd->reserve(1000000);
+			for (size_t i = 0; i < 1000000; i++)
+				herd->add_animal(SPECIES::SHEEP);
+			herd->move();
+			herd->draw_dirty(0.);
+			watch.start();
+			for (size_t i = 0; i < iterations; i++)
+				herd->draw_dirty(double(i % 2));
+		} });
+
+		// Scaling of the movement step with the number of threads, from one
+		// to every core by powers of two
+		unsigned core_count = SDL_GetCPUCount();
+		for (unsigned thread_count = 1; ; thread_count = std::min(2 * thread_count, core_count))
+		{
+			benchmarks.push_back({ "ground::move/1000000/" + std::to_string(thread_count) +
+				" threads", 1000000, [surface, thread_count](size_t iterations, stopwatch& watch) {
+				std::unique_ptr<ground> herd = create_herd(surface, 1000000, 0, thread_count);
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+					herd->move();
+			} });
+			if (thread_count >= core_count)
+				break;
+		}
+
+		// The wolves slowly eat the sheep, so a long run measures a smaller herd
+		benchmarks.push_back({ "ground::move/10000 sheep, 100 wolves", 10100,
+			[surface](size_t iterations, stopwatch& watch) {
+			std::unique_ptr<ground> herd = create_herd(surface, 10000, 100, 1);
+			watch.start();
+			for (size_t i = 0; i < iterations; i++)
+				herd->move();
+		} });
+
+		// Predator heavy: every wolf queries the sheep around it at each step.
+		// The eaten sheep are replaced after each step so that the herd keeps
+		// its mix, which costs little next to the queries.
+		benchmarks.push_back({ "ground::move/100000 sheep, 10000 wolves", 110000,
+			[surface](size_t iterations, stopwatch& watch) {
+			std::unique_ptr<ground> herd = create_herd(surface, 100000, 10000, 1);
+			watch.start();
+			for (size_t i = 0; i < iterations; i++)
+			{
+				herd->move();
+				while (herd->count(SPECIES::SHEEP) < 100000)
+					herd->add_animal(SPECIES::SHEEP);
+			}
+		} });
+
+		// New targets for the whole herd, with the default boundary and retarget
+		// radius known at compile time, then with a boundary read at run time
+		for (unsigned boundary : { frame_boundary, frame_boundary + 1 })
+		{
+			benchmarks.push_back({ std::string("ground::retarget/100000/") +
+				(boundary == frame_boundary ? "default" : "configured"), 100000,
+				[surface, boundary](size_t iterations, stopwatch& watch) {
+				run_config config;
+				config.frame_boundary = boundary;
+				auto herd = std::make_unique<ground>(surface, nullptr, 42, 1, config);
+				herd->reserve(100000);
+				std::vector<Uint32> indices;
+				for (Uint32 i = 0; i < 100000; i++)
+				{
+					herd->add_animal(SPECIES::SHEEP);
+					indices.push_back(i);
+				}
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+					herd->retarget(indices.data(), indices.size());
+			} });
+		}
+
+		benchmarks.push_back({ "ground::add_animal", 1,
+			[surface](size_t iterations, stopwatch& watch) {
+			ground herd(surface, nullptr, 42, 1);
+			watch.start();
+			for (size_t i = 0; i < iterations; i++)
+				herd.add_animal(SPECIES::SHEEP);
+		} });
+
+		// Each iteration removes 1% of the herd at random then spawns as many
+		// animals, the note compares the memory held to what the herd needs
+		benchmarks.push_back({ "ground::remove_animals/100000 churn", 2000,
+			[surface](size_t iterations, stopwatch& watch) {
+			std::unique_ptr<ground> herd = create_herd(surface, 100000, 0, 1);
+			size_t bytes_per_animal = herd->memory_used() / herd->size();
+			random_generator generator(1);
+			std::vector<animal_handle> removed(1000);
+			watch.start();
+			for (size_t i = 0; i < iterations; i++)
+			{
+				for (animal_handle& handle : removed)
+					handle = herd->handle_of(generator.between(0, int(herd->size()) - 1));
+				herd->remove_animals(removed.data(), removed.size());
+				while (herd->size() < 100000)
+					herd->add_animal(SPECIES::SHEEP);
+			}
+			watch.note = std::to_string(herd->memory_used() / 1024) + " KiB held for " +
+				std::to_string(herd->size() * bytes_per_animal / 1024) + " KiB of animals";
+		} });
+
+		for (size_t herd_size : { 10000, 100000 })
+		{
+			benchmarks.push_back({ "ground::nearest/" + std::to_string(herd_size), 1,
+				[surface, herd_size](size_t iterations, stopwatch& watch) {
+				std::unique_ptr<ground> herd = create_herd(surface, herd_size, 0, 1);
+				herd->move();
+				random_generator generator(1);
+				Uint64 total = 0;
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+					total += herd->nearest(generator.between(0, frame_width),
+						generator.between(0, frame_height), 60, SPECIES::SHEEP);
+				sink = total;
+			} });
+
+			benchmarks.push_back({ "ground::query_radius/" + std::to_string(herd_size), 1,
+				[surface, herd_size](size_t iterations, stopwatch& watch) {
+				std::unique_ptr<ground> herd = create_herd(surface, herd_size, 0, 1);
+				herd->move();
+				random_generator generator(1);
+				std::vector<Uint32> result;
+				Uint64 total = 0;
+				watch.start();
+				for (size_t i = 0; i < iterations; i++)
+				{
+					herd->query_radius(generator.between(0, frame_width),
+						generator.between(0, frame_height), 60, result);
+					total += result.size();
+				}
+				sink = total;
+			} });
+		}
+		return benchmarks;
+	}
+
+	// Time one run of the body, in seconds
+	double time_run(const benchmark& bench, size_t iterations, std::string& note) {
+		stopwatch watch;
+		bench.body(iterations, watch);
+		note = watch.note;
+		return double(SDL_GetPerformanceCounter() - watch.start_counter) /
+			SDL_GetPerformanceFrequency();
+	}
+}
+
+int main(int argc, char* argv[]) {
+
+	// Run the benchmarks whose name contains the filter, all by default
+	std::string filter;
+	double min_time = 0.5;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--min-time" && i + 1 < argc)
+			min_time = std::stod(argv[++i]);
+		else if (filter.empty())
+			filter = argument;
+		else
+			throw std::runtime_error("Usage: ProjetEpitaSDLBench [filter] "
+				"[--min-time <seconds>]\n");
+	}
+
+	init(true);
+	// The sprites are drawn onto an offscreen surface, no window is needed
+	if (!(IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG))
+		throw std::runtime_error("SDL_image could not initialize! SDL_image Error: " +
+			std::string(IMG_GetError()));
+
+	surface_ptr surface = create_offscreen_surface();
+
+	int failures = 0;
+	for (const check& test : all_checks())
+	{
+		if (test.name.find(filter) == std::string::npos)
+			continue;
+		std::string failure = test.body();
+		std::cout << std::left << std::setw(40) << test.name
+			<< (failure.empty() ? "ok" : "FAILED: " + failure) << std::endl;
+		failures += !failure.empty();
+	}
+
+	std::cout << std::left << std::setw(40) << "benchmark" << std::right
+		<< std::setw(12) << "iterations" << std::setw(16) << "ns/iteration"
+		<< std::setw(16) << "items/s" << std::endl;
+	for (const benchmark& bench : all_benchmarks(surface.get()))
+	{
+		if (bench.name.find(filter) == std::string::npos)
+			continue;
+		size_t iterations = 1;
+		std::string note;
+		double elapsed = time_run(bench, iterations, note);
+		while (elapsed < min_time) {
+			iterations *= 2;
+			elapsed = time_run(bench, iterations, note);
+		}
+		std::cout << std::left << std::setw(40) << bench.name << std::right
+			<< std::setw(12) << iterations
+			<< std::setw(16) << std::fixed << std::setprecision(1) << 1e9 * elapsed / iterations
+			<< std::setw(16) << std::setprecision(0)
+			<< bench.items_per_iteration * iterations / elapsed
+			<< (note.empty() ? "" : "  ") << note << std::endl;
+	}
+
+	IMG_Quit();
+	SDL_Quit();
+	return failures ? 1 : 0;
+}